@@ -0,0 +1,149 @@
+#include "linked_list.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "common_defs.h"
+#include "gitdata.h"
+
+// Memory pool every benchmark fills
+#define BENCH_POOL_SIZE (1 << 20)
+// The throughput benchmark's list is split in this many parts, which the threads share out,
+// so every run does the same work whatever the number of threads
+#define BENCH_PARTS 8
+#define BENCH_PART_NODES 256
+// Insert, search and delete rounds done in each part
+#define BENCH_ROUNDS_PER_PART 1024
+
+typedef struct
+{
+    Node **head;
+    Node *anchors[BENCH_PARTS]; // The first node of each part, new nodes go behind it
+    int first_part;             // Parts this thread works in: 'first_part', then every 'part_step' after it
+    int part_step;
+} bench_thread_t;
+
+static double seconds_since(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Fills a pool with as many nodes as fit, then walks and searches the list.
+// Reports the memory each node takes and how long the walks took
+void bench_memory_per_node()
+{
+#if defined(LIST_LOCK_FREE)
+    const char *layout = "lock-free";
+#elif defined(LIST_COMPACT_NODE)
+    const char *layout = "compact";
+#else
+    const char *layout = "default";
+#endif
+    printf_yellow("  Node layout: %s\n", layout);
+
+    Node *head = NULL;
+    list_init(&head, BENCH_POOL_SIZE);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int nodes = BENCH_POOL_SIZE / sizeof(Node);
+    for (int i = 0; i < nodes; i++)
+        list_insert(&head, i);
+    double insert_time = seconds_since(&start);
+
+    struct mem_stats stats;
+    mem_stats(&stats);
+
+    // Walks the nodes itself, as list_count_nodes may know the count without walking
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int counted = 0;
+    for (Node *walker = head; walker != NULL; walker = walker->next)
+        counted++;
+    double walk_time = seconds_since(&start);
+
+    // The last value inserted, so the search walks all of the list
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    list_search(&head, (uint16_t)(nodes - 1));
+    double search_time = seconds_since(&start);
+
+    printf("    sizeof(Node):            %zu bytes\n", sizeof(Node));
+    printf("    nodes in a %d KiB pool: %d\n", BENCH_POOL_SIZE >> 10, counted);
+    printf("    pool bytes per node:     %.1f\n", (double)stats.bytes_used / counted);
+    printf("    insert all:              %.3f ms\n", insert_time * 1e3);
+    printf("    walk all:                %.3f ms (%.2f ns per node)\n", walk_time * 1e3, walk_time * 1e9 / counted);
+    printf("    search all:              %.3f ms (%.2f ns per node)\n", search_time * 1e3, search_time * 1e9 / counted);
+
+    list_cleanup(&head);
+}
+
+// Inserts a node behind the start of each of this thread's parts of the list, finds it and deletes it again
+void *bench_thread_function(void *arg)
+{
+    bench_thread_t *data = (bench_thread_t *)arg;
+    for (int i = 0; i < BENCH_ROUNDS_PER_PART; i++)
+    {
+        for (int part = data->first_part; part < BENCH_PARTS; part += data->part_step)
+        {
+            uint16_t value = BENCH_PARTS + part;
+            list_insert_after(data->anchors[part], value);
+            list_search(data->head, value);
+            list_delete(data->head, value);
+        }
+    }
+    return NULL;
+}
+
+// Threads insert, search and delete in disjoint parts of one list at the same time.
+// Reports the operations per second for each number of threads
+void bench_throughput()
+{
+    printf_yellow("  Inserts, searches and deletes in %d disjoint parts of a list\n", BENCH_PARTS);
+
+    for (int threads = 1; threads <= BENCH_PARTS; threads *= 2)
+    {
+        Node *head = NULL;
+        list_init(&head, BENCH_POOL_SIZE);
+
+        // Each part starts with the node new nodes go behind, values 0 to BENCH_PARTS - 1
+        Node *anchors[BENCH_PARTS];
+        for (int part = 0; part < BENCH_PARTS; part++)
+        {
+            list_insert(&head, part);
+            anchors[part] = list_search(&head, part);
+            for (int i = 0; i < BENCH_PART_NODES; i++)
+                list_insert(&head, UINT16_MAX);
+        }
+
+        bench_thread_t data[BENCH_PARTS];
+        for (int t = 0; t < threads; t++)
+        {
+            data[t] = (bench_thread_t){.head = &head, .first_part = t, .part_step = threads};
+            memcpy(data[t].anchors, anchors, sizeof(anchors));
+        }
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pthread_t ids[BENCH_PARTS];
+        for (int t = 0; t < threads; t++)
+            pthread_create(&ids[t], NULL, bench_thread_function, &data[t]);
+        for (int t = 0; t < threads; t++)
+            pthread_join(ids[t], NULL);
+        double time = seconds_since(&start);
+
+        double ops = 3.0 * BENCH_PARTS * BENCH_ROUNDS_PER_PART;
+        printf("    %d thread%s %10.0f ops/s\n", threads, threads == 1 ? ": " : "s:", ops / time);
+
+        list_cleanup(&head);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    printf("Git Version; %s/%s \n", git_date, git_sha);
+    printf("Linked list benchmarks:\n");
+    bench_memory_per_node();
+    bench_throughput();
+
+    return 0;
+}
@@ -1,166 +1,553 @@
 #include "linked_list.h"
+#include <sched.h>
+#include <stddef.h>
 
-pthread_rwlock_t rw_lock;
+#ifdef LIST_LOCK_FREE
 
-// Initializes the list by intiliazing the memory_manager with a memory pool of 'size'
-void list_init(Node** head, size_t size){
-    pthread_rwlock_init(&rw_lock, NULL);
+// Lock-free lists after Harris and Michael. Nodes are linked in and out with compare-and-swap on
+// the pointer in front of them. A node is deleted by setting the lowest bit of its own next pointer
+// first, which makes every later swap of that pointer fail, so nothing can be linked in behind it.
+// Only then is it unlinked. Threads that come across a marked node unlink it on their way.
+//
+// An unlinked node may still be read by threads that got to it before, so it is only handed back
+// to the memory manager once all of them are done, which is tracked with epochs: every thread notes
+// the global epoch as it enters a list call, and the epoch only moves on once every thread inside
+// a call has seen it. A node retired in epoch e is freed once the epoch reaches e + 2
 
-    mem_init(size);
-    *head = NULL;
+// Epochs a retired node can be waiting for, one batch of retired nodes each
+#define EPOCH_COUNT 3
+// Nodes a thread retires before it tries to advance the epoch and free old batches
+#define RETIRE_BATCH 64
+// Times a thread that finds the pool full tries to free retired nodes before it gives up
+#define RECLAIM_ATTEMPTS 8
+
+// Nodes a thread retired in one epoch
+typedef struct retired_nodes{
+    unsigned long long epoch;
+    void** nodes;
+    size_t count;
+    size_t capacity;
+} retired_nodes;
+
+// A thread's part in reclaiming nodes. Records are never freed: one whose thread exited is taken
+// over by the next thread that needs a record, together with the nodes it still holds
+typedef struct epoch_record{
+    // Epoch the thread entered its current call in, shifted up by one. The lowest bit is set during the call
+    unsigned long long state;
+    bool in_use;
+    retired_nodes retired[EPOCH_COUNT];
+    struct epoch_record* next;
+} epoch_record;
+
+static unsigned long long list_epoch = 0;
+static epoch_record* epoch_records = NULL;
+
+// The key only gives back a thread's record when the thread exits
+static pthread_key_t epoch_key;
+static pthread_once_t epoch_key_once = PTHREAD_ONCE_INIT;
+static _Thread_local epoch_record* thread_record = NULL;
+
+static void epoch_record_exit(void* record){
+    __atomic_store_n(&((epoch_record*)record)->in_use, false, __ATOMIC_RELEASE);
 }
 
-// Inserts new node with data of 'data' at the end of list
-void list_insert(Node** head, uint16_t data){
-    pthread_rwlock_wrlock(&rw_lock);
+static void epoch_key_create(){
+    pthread_key_create(&epoch_key, epoch_record_exit);
+}
 
-    Node* new_node = mem_alloc(sizeof(Node));
-    if(new_node == 0){
-        // Can't allocate new node
-        printf("ERROR!");
-        pthread_rwlock_unlock(&rw_lock);
-        return;
+// Returns the calling thread's record, taking over an unused one or adding a new one on its first call.
+// Returns NULL if there is no record to take over and no memory for a new one
+static epoch_record* epoch_record_get(){
+    if(thread_record != NULL)
+        return thread_record;
+    pthread_once(&epoch_key_once, epoch_key_create);
+
+    epoch_record* record = __atomic_load_n(&epoch_records, __ATOMIC_ACQUIRE);
+    for(; record != NULL; record = record->next){
+        bool unused = false;
+        if(__atomic_compare_exchange_n(&record->in_use, &unused, true, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
     }
-    new_node->data = data;
-    new_node->next = NULL;
 
-    if(*head == NULL){
-        *head = new_node;
+    if(record == NULL){
+        record = calloc(1, sizeof(epoch_record));
+        if(record == NULL){
+            // Can't take part in reclaiming without a record, the next call tries again
+            printf("ERROR: can't allocate epoch record!");
+            return NULL;
+        }
+        record->in_use = true;
+        record->next = __atomic_load_n(&epoch_records, __ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(&epoch_records, &record->next, record, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
     }
-    else{
-        // Walk 'til end of list, then insert
-        Node* walker = *head;
-        while(walker->next != NULL){
-            walker = walker->next;
+
+    pthread_setspecific(epoch_key, record);
+    thread_record = record;
+    return record;
+}
+
+// Enters a list call, returns the calling thread's record and the epoch it entered in.
+// Returns NULL if the thread has no record, in which case it mustn't touch the list
+static epoch_record* epoch_enter(unsigned long long* epoch){
+    epoch_record* record = epoch_record_get();
+    if(record == NULL)
+        return NULL;
+    *epoch = __atomic_load_n(&list_epoch, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&record->state, *epoch << 1 | 1, __ATOMIC_SEQ_CST);
+    // No node may be read before the record shows the thread is in a call
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return record;
+}
+
+static void epoch_exit(epoch_record* record){
+    __atomic_store_n(&record->state, 0, __ATOMIC_RELEASE);
+}
+
+// Moves the epoch on, if every thread inside a list call has entered it in the current one
+static void epoch_try_advance(){
+    unsigned long long epoch = __atomic_load_n(&list_epoch, __ATOMIC_SEQ_CST);
+    for(epoch_record* record = __atomic_load_n(&epoch_records, __ATOMIC_ACQUIRE); record != NULL; record = record->next){
+        unsigned long long state = __atomic_load_n(&record->state, __ATOMIC_SEQ_CST);
+        if((state & 1) && state >> 1 != epoch)
+            return;
+    }
+    __atomic_compare_exchange_n(&list_epoch, &epoch, epoch + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+// Hands a batch of retired nodes back to the memory manager in one go
+static void retired_free(retired_nodes* retired){
+    mem_free_batch(retired->nodes, retired->count);
+    retired->count = 0;
+}
+
+// Frees the batches of 'record' no thread can still be reading
+static void epoch_reclaim(epoch_record* record){
+    unsigned long long epoch = __atomic_load_n(&list_epoch, __ATOMIC_SEQ_CST);
+    for(int i = 0; i < EPOCH_COUNT; i++){
+        retired_nodes* retired = &record->retired[i];
+        if(retired->count > 0 && retired->epoch + 2 <= epoch)
+            retired_free(retired);
+    }
+}
+
+// Frees 'node', which was unlinked, once no thread can still be reading it
+static void epoch_retire(epoch_record* record, Node* node){
+    unsigned long long epoch = __atomic_load_n(&list_epoch, __ATOMIC_SEQ_CST);
+    retired_nodes* retired = &record->retired[epoch % EPOCH_COUNT];
+
+    // A batch left from an earlier epoch that shares the slot is at least EPOCH_COUNT epochs old
+    if(retired->count > 0 && retired->epoch != epoch)
+        retired_free(retired);
+
+    if(retired->count == retired->capacity){
+        size_t capacity = retired->capacity ? retired->capacity * 2 : RETIRE_BATCH;
+        void** nodes = realloc(retired->nodes, capacity * sizeof(void*));
+        if(nodes == NULL)
+            return; // The node stays allocated until the pool is deinitialized
+        retired->nodes = nodes;
+        retired->capacity = capacity;
+    }
+    retired->epoch = epoch;
+    retired->nodes[retired->count++] = node;
+
+    if(retired->count % RETIRE_BATCH == 0){
+        epoch_try_advance();
+        epoch_reclaim(record);
+    }
+}
+
+// Frees as much of what was retired as the threads in list calls let it, including what threads
+// that exited left behind. Called outside of a list call
+static void epoch_reclaim_all(epoch_record* record){
+    for(int i = 0; i < EPOCH_COUNT; i++)
+        epoch_try_advance();
+    epoch_reclaim(record);
+
+    for(epoch_record* other = __atomic_load_n(&epoch_records, __ATOMIC_ACQUIRE); other != NULL; other = other->next){
+        bool unused = false;
+        if(__atomic_compare_exchange_n(&other->in_use, &unused, true, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+            epoch_reclaim(other);
+            __atomic_store_n(&other->in_use, false, __ATOMIC_RELEASE);
         }
+    }
+}
 
-        walker->next = new_node;
+// Drops every retired node of every thread, for when the pool they are in is deinitialized.
+// No thread may be in a list call
+static void epoch_forget_all(){
+    for(epoch_record* record = __atomic_load_n(&epoch_records, __ATOMIC_ACQUIRE); record != NULL; record = record->next){
+        for(int i = 0; i < EPOCH_COUNT; i++)
+            record->retired[i].count = 0;
     }
-    
-    // Node* new_node = mem_alloc(sizeof(Node));
-    // if(new_node == 0){
-    //     printf("ERROR!");
-    // }
-    // new_node->data = data;
-    // new_node->next = *head;
-    // *head = new_node;
+}
 
-    pthread_rwlock_unlock(&rw_lock);
+// The lowest bit of a node's next pointer marks the node as deleted
+static bool is_marked(Node* next){
+    return (uintptr_t)next & 1;
 }
 
-// Inserts a new node inbetween prev_node and prev_node->next
-void list_insert_after(Node* prev_node, uint16_t  data){
-    pthread_rwlock_wrlock(&rw_lock);
+static Node* marked(Node* next){
+    return (Node*)((uintptr_t)next | 1);
+}
+
+static Node* unmarked(Node* next){
+    return (Node*)((uintptr_t)next & ~(uintptr_t)1);
+}
+
+static Node* link_load(Node** link){
+    return __atomic_load_n(link, __ATOMIC_ACQUIRE);
+}
 
+// Swaps the pointer at 'link' from 'expected' to 'desired', returns false if it held something else
+static bool link_swap(Node** link, Node* expected, Node* desired){
+    return __atomic_compare_exchange_n(link, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE);
+}
+
+// The node a next pointer belongs to
+static Node* node_of(Node** link){
+    return (Node*)((char*)link - offsetof(Node, next));
+}
+
+// Allocates a node holding 'data', or returns NULL if the pool is full
+static Node* node_create(uint16_t data){
     Node* new_node = mem_alloc(sizeof(Node));
+
+    // Retired nodes may be what fills the pool. A thread that was stopped inside a list call
+    // holds up freeing them, so it gets the chance to finish its call in between attempts
+    for(int i = 0; new_node == 0 && i < RECLAIM_ATTEMPTS; i++){
+        epoch_record* record = epoch_record_get();
+        if(record == NULL)
+            break;
+        if(i > 0)
+            sched_yield();
+        epoch_reclaim_all(record);
+        new_node = mem_alloc(sizeof(Node));
+    }
     if(new_node == 0){
         // Can't allocate new node
         printf("ERROR!");
-        pthread_rwlock_unlock(&rw_lock);
-        return;
+        return NULL;
     }
     new_node->data = data;
-    new_node->next = prev_node->next;
-    prev_node->next = new_node;
+    // Only nodes known to be in the list the kept List stands for carry its generation, see legacy_list
+    __atomic_store_n(&new_node->generation, 0, __ATOMIC_RELAXED);
+    new_node->next = NULL;
+    return new_node;
+}
 
-    pthread_rwlock_unlock(&rw_lock);
+typedef bool (*node_match)(Node* node, const void* key);
+
+static bool match_data(Node* node, const void* key){
+    return node->data == *(const uint16_t*)key;
 }
 
-// Insert node with data 'data' before node 'next_node'. 
-// Uses 'head' to start traversing through the list
-void list_insert_before(Node** head, Node* next_node, uint16_t  data){
-    pthread_rwlock_wrlock(&rw_lock);
+static bool match_node(Node* node, const void* key){
+    return node == key;
+}
 
-    Node* new_node = mem_alloc(sizeof(Node));
-        if(new_node == 0){
-        // Can't allocate new node
-        printf("ERROR!");
-        pthread_rwlock_unlock(&rw_lock);
-        return;
+static bool match_none(Node* node, const void* key){
+    return false;
+}
+
+// Walks the list from 'head' to the first node 'match' accepts, unlinking the marked nodes it passes.
+// Returns that node, or NULL at the end of the list, and stores the pointer leading to it in 'link'
+static Node* locate(Node** head, node_match match, const void* key, Node*** link){
+    Node** prev = head;
+    Node* walker = link_load(prev);
+    while(walker != NULL){
+        Node* next = link_load(&walker->next);
+        if(is_marked(next)){
+            // If the node in front changed, it can't be unlinked from here, so start over
+            if(link_swap(prev, walker, unmarked(next))){
+                walker = unmarked(next);
+            }
+            else{
+                prev = head;
+                walker = link_load(prev);
+            }
+        }
+        else if(match(walker, key)){
+            break;
+        }
+        else{
+            prev = &walker->next;
+            walker = next;
+        }
     }
-    new_node->data = data;
-    
-    if(next_node == *head){
-        //Insert before 'head', which means just insert at beginning of list
-        new_node->next = *head;
-        *head = new_node;
+    *link = prev;
+    return walker;
+}
+
+// The Node** functions append through this List, kept for the head they were last called with,
+// so appending doesn't walk the list. Its tail is only a hint like any List's, but as nothing
+// locks the List while the head it stands for changes, a thread may still be setting the tail
+// to a node of the list it stood for before. So every change of head starts a new generation,
+// odd while it is changing. Nodes appended through the kept List carry its generation, and so
+// do nodes inserted next to them, so its tail is only taken if it carries the current one
+static List legacy_list = {NULL, NULL, 0};
+static Node** legacy_head = NULL;
+static uint32_t legacy_generation = 0;
+
+// The generation the kept List stands for 'head' in, or 0 if it stands for another list
+static uint32_t legacy_get(Node** head){
+    uint32_t generation = __atomic_load_n(&legacy_generation, __ATOMIC_SEQ_CST);
+    if(generation & 1)
+        return 0;
+    Node** kept_head = __atomic_load_n(&legacy_head, __ATOMIC_SEQ_CST);
+    if(kept_head != head || __atomic_load_n(&legacy_generation, __ATOMIC_SEQ_CST) != generation)
+        return 0;
+    return generation;
+}
+
+// Makes the kept List stand for 'head', returns its new generation, or 0 if another thread is
+// changing it at the same time
+static uint32_t legacy_switch(Node** head){
+    uint32_t generation = __atomic_load_n(&legacy_generation, __ATOMIC_SEQ_CST);
+    if((generation & 1) || !__atomic_compare_exchange_n(&legacy_generation, &generation, generation + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return 0;
+
+    __atomic_store_n(&legacy_head, head, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&legacy_list.tail, NULL, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&legacy_list.count, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&legacy_generation, generation + 2, __ATOMIC_SEQ_CST);
+    return generation + 2;
+}
+
+// The generation new nodes in the list from 'head' carry
+static uint32_t legacy_generation_of(Node** head){
+    uint32_t generation = legacy_get(head);
+    return generation != 0 ? generation : legacy_switch(head);
+}
+
+// Whether 'node' can't be the kept List's tail, as it carries an earlier generation
+static bool legacy_stale(List* list, Node* node){
+    return list == &legacy_list && __atomic_load_n(&node->generation, __ATOMIC_RELAXED) != __atomic_load_n(&legacy_generation, __ATOMIC_SEQ_CST);
+}
+
+// The last node 'list' knows of, if it may be walked from: it isn't deleted, and the epoch the
+// caller entered in still holds, so it can't have been freed while being looked at.
+// The kept List's tail also has to be in the list, see legacy_list
+static Node* tail_hint(List* list, unsigned long long epoch){
+    Node* tail = __atomic_load_n(&list->tail, __ATOMIC_SEQ_CST);
+    if(tail == NULL)
+        return NULL;
+    Node* next = __atomic_load_n(&tail->next, __ATOMIC_SEQ_CST);
+    if(is_marked(next) || __atomic_load_n(&list_epoch, __ATOMIC_SEQ_CST) != epoch || legacy_stale(list, tail))
+        return NULL;
+    return tail;
+}
+
+// Points the tail of 'list' at 'node'. A node deleted in the meantime mustn't stay the tail
+// once it is retired, so whoever sees it marked takes it out again. The same goes for a node
+// of the list the kept List stood for before
+static void tail_set(List* list, Node* old_tail, Node* node){
+    if(old_tail == NULL)
+        __atomic_store_n(&list->tail, node, __ATOMIC_SEQ_CST);
+    else if(!link_swap(&list->tail, old_tail, node))
+        return;
+
+    if(node != NULL && (is_marked(link_load(&node->next)) || legacy_stale(list, node)))
+        link_swap(&list->tail, node, NULL);
+}
+
+// Links 'new_node' in at the end of the list from 'head'. The tail of 'list', if given,
+// is where the first try starts
+static void append(Node** head, List* list, Node* new_node, unsigned long long epoch){
+    Node* start = list ? tail_hint(list, epoch) : NULL;
+    Node** link = start ? &start->next : head;
+
+    // Marked nodes are only walked past, in case one of them turns out to be last
+    Node* walker;
+    while((walker = unmarked(link_load(link))) != NULL)
+        link = &walker->next;
+
+    while(!link_swap(link, NULL, new_node))
+        locate(head, match_none, NULL, &link);
+
+    if(list != NULL){
+        __atomic_add_fetch(&list->count, 1, __ATOMIC_RELAXED);
+        tail_set(list, NULL, new_node);
     }
-    else{
-        // Traverse through the list until it finds the node before 'next_node'
-        Node* walker = *head;
-        while(walker->next != NULL && walker->next != next_node){
-            walker = walker->next;
+}
+
+// Delete the first node from 'head' on that contains 'data'. Returns false if there is none
+static bool remove_first(Node** head, List* list, uint16_t data, epoch_record* record){
+    for(;;){
+        Node** link;
+        Node* node = locate(head, match_data, &data, &link);
+        if(node == NULL)
+            return false;
+
+        // Mark it, or start over if it was deleted or had a node inserted behind it in the meantime
+        Node* next = link_load(&node->next);
+        if(is_marked(next) || !link_swap(&node->next, next, marked(next)))
+            continue;
+
+        if(list != NULL){
+            __atomic_sub_fetch(&list->count, 1, __ATOMIC_RELAXED);
+            tail_set(list, node, link == head ? NULL : node_of(link));
         }
 
-        // Then make new node point to 'next node',
-        // and the node previously pointing to 'next node', to instead point to new node.
-        new_node->next = next_node;
-        walker->next = new_node;
-    }
+        // If the pointer in front changed, a walk over the whole list makes sure it is unlinked
+        if(!link_swap(link, node, next))
+            locate(head, match_none, NULL, &link);
 
-    pthread_rwlock_unlock(&rw_lock);
+        epoch_retire(record, node);
+        return true;
+    }
 }
 
-// Delete the first node that contains 'data'
-void list_delete(Node** head, uint16_t  data){
-    pthread_rwlock_wrlock(&rw_lock);
-    if(*head == NULL){
-        printf("ERROR: Deleting from empty list!");
-        pthread_rwlock_unlock(&rw_lock);
-        return;
+// Searches the list starting at 'head' to find node containing 'data'.
+// Only reads, so it never waits for other threads
+static Node* find(Node** head, uint16_t data){
+    Node* walker = link_load(head);
+    while(walker != NULL){
+        Node* next = link_load(&walker->next);
+        if(!is_marked(next) && walker->data == data)
+            break;
+        walker = unmarked(next);
     }
-    
-    if((*head)->data == data){
-        // If the first node has 'data', simply change what head points toward
-        Node* toDel = *head;
-        *head = (*head)->next;
+    return walker;
+}
+
+// The node after 'node' that isn't deleted, or NULL
+static Node* next_live(Node* node){
+    Node* walker = unmarked(link_load(&node->next));
+    while(walker != NULL && is_marked(link_load(&walker->next)))
+        walker = unmarked(link_load(&walker->next));
+    return walker;
+}
+
+// Frees every node of the list starting at 'head'. No thread may be using it
+static void free_all(Node* head){
+    Node* walker = head;
+    while(walker != NULL){
+        Node* toDel = walker;
+        walker = unmarked(walker->next);
 
         mem_free(toDel);
     }
-    else{
-        // Otherwise traverse through the list to find it
-        Node* walker = *head;
-        while(walker->next != NULL && walker->next->data != data){
-            walker = walker->next;
+}
 
-            if(walker->next != NULL){
-                Node* toDel = walker->next;
-                walker->next = toDel->next;
+// Initializes the list by intiliazing the memory_manager with a memory pool of 'size'
+void list_init(Node** head, size_t size){
+    mem_init(size);
+    *head = NULL;
+    legacy_switch(NULL);
+}
 
-                mem_free(toDel);
-            }
+// Inserts new node with data of 'data' at the end of list
+void list_insert(Node** head, uint16_t data){
+    Node* new_node = node_create(data);
+    if(new_node == NULL)
+        return;
+
+    unsigned long long epoch;
+    epoch_record* record = epoch_enter(&epoch);
+    if(record == NULL){
+        mem_free(new_node);
+        return;
+    }
+
+    // If another thread is changing the kept List, walk the list instead
+    uint32_t generation = legacy_generation_of(head);
+    __atomic_store_n(&new_node->generation, generation, __ATOMIC_RELAXED);
+    append(head, generation != 0 ? &legacy_list : NULL, new_node, epoch);
+    epoch_exit(record);
+}
+
+// Inserts a new node inbetween prev_node and prev_node->next
+void list_insert_after(Node* prev_node, uint16_t  data){
+    Node* new_node = node_create(data);
+    if(new_node == NULL)
+        return;
+
+    unsigned long long epoch;
+    epoch_record* record = epoch_enter(&epoch);
+    if(record == NULL){
+        mem_free(new_node);
+        return;
+    }
+    for(;;){
+        Node* next = link_load(&prev_node->next);
+        if(is_marked(next)){
+            // 'prev_node' was deleted, the new node would be lost behind it
+            printf("ERROR: Inserting after a deleted node!");
+            mem_free(new_node);
+            break;
         }
+        // It is in whichever list 'prev_node' is
+        __atomic_store_n(&new_node->generation, __atomic_load_n(&prev_node->generation, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+        new_node->next = next;
+        if(link_swap(&prev_node->next, next, new_node))
+            break;
     }
+    epoch_exit(record);
+}
 
-    pthread_rwlock_unlock(&rw_lock);
+// Insert node with data 'data' before node 'next_node', or at the end if it isn't in the list.
+// Uses 'head' to start traversing through the list
+void list_insert_before(Node** head, Node* next_node, uint16_t  data){
+    Node* new_node = node_create(data);
+    if(new_node == NULL)
+        return;
+
+    unsigned long long epoch;
+    epoch_record* record = epoch_enter(&epoch);
+    if(record == NULL){
+        mem_free(new_node);
+        return;
+    }
+    __atomic_store_n(&new_node->generation, legacy_get(head), __ATOMIC_RELAXED);
+    for(;;){
+        Node** link;
+        new_node->next = locate(head, match_node, next_node, &link);
+        if(link_swap(link, new_node->next, new_node))
+            break;
+    }
+    epoch_exit(record);
+}
+
+// Delete the first node that contains 'data'
+void list_delete(Node** head, uint16_t  data){
+    if(link_load(head) == NULL){
+        printf("ERROR: Deleting from empty list!");
+        return;
+    }
+
+    unsigned long long epoch;
+    epoch_record* record = epoch_enter(&epoch);
+    if(record == NULL)
+        return;
+    // Deleting the kept List's tail moves it back
+    remove_first(head, legacy_get(head) != 0 ? &legacy_list : NULL, data, record);
+    epoch_exit(record);
 }
 
 // Searches the list to find node containing 'data'
 Node* list_search(Node** head, uint16_t  data){
-    pthread_rwlock_rdlock(&rw_lock);
-
     // If the list is empty, immediately return NULL
     if(head == NULL){
         printf("ERROR: head is null");
-        pthread_rwlock_unlock(&rw_lock);
         return NULL;
     }
-    
+
     // Traverses through the list
-    Node* walker = *head;
-    while(walker != NULL && walker->data != data){
-        walker = walker->next;
-    }
+    unsigned long long epoch;
+    epoch_record* record = epoch_enter(&epoch);
+    if(record == NULL)
+        return NULL;
+    Node* walker = find(head, data);
+    epoch_exit(record);
 
     if (walker == NULL){
-        // If it walks through the entire list and can't find 'data', 
+        // If it walks through the entire list and can't find 'data',
         // then it doesn't exists, so return NULL
         printf("ERROR: can't find data.");
-        pthread_rwlock_unlock(&rw_lock);
         return NULL;
     }
     else{
-        pthread_rwlock_unlock(&rw_lock);
         return walker;
     }
 }
@@ -172,58 +559,636 @@ void list_display(Node** head){
 
 // Displays the entire list in format [0, 1, 2, 3, etc]
 void list_display_range(Node** head, Node* start_node, Node* end_node){
-    pthread_rwlock_rdlock(&rw_lock);
+    unsigned long long epoch;
+    epoch_record* record = epoch_enter(&epoch);
+    if(record == NULL)
+        return;
 
-    // By default, traversing starts at head, 
+    // By default, traversing starts at head,
     // but if 'start node' is specified, start there instead
-    Node* walker = *head;
+    Node* walker = link_load(head);
     if(start_node != NULL)
         walker = start_node;
-        
+
     printf("[");
     printf("%d", walker->data);
     // Walk through list and print until we reach either 'end_node' or NULL
-    while(walker->next != NULL && walker != end_node){
-        walker = walker->next;
+    while(walker != end_node && (walker = next_live(walker)) != NULL){
         printf(", %d", walker->data);
     }
     printf("]");
 
-    pthread_rwlock_unlock(&rw_lock);
+    epoch_exit(record);
 }
 
 // Counts amount of nodes in list by traversing through the whole list and increasing count for each one
 int list_count_nodes(Node** head){
-    pthread_rwlock_rdlock(&rw_lock);
+    unsigned long long epoch;
+    epoch_record* record = epoch_enter(&epoch);
+    if(record == NULL)
+        return 0;
 
     int count = 0;
-    Node* walker = *head;
+    Node* walker = link_load(head);
     while(walker != NULL){
-        count++;
-        walker = walker->next;
+        Node* next = link_load(&walker->next);
+        if(!is_marked(next))
+            count++;
+        walker = unmarked(next);
     }
 
-    pthread_rwlock_unlock(&rw_lock);
+    epoch_exit(record);
     return count;
 }
 
-// Deinitializes the list, by freeing all related memory
+// Deinitializes the list, by freeing all related memory. No other thread may be using it
 void list_cleanup(Node** head){
-    pthread_rwlock_wrlock(&rw_lock);
-    Node* walker = *head;
-    
     // This is unneccessary
+    free_all(*head);
+
+    // Deinitializes the memory, retired nodes go with it
+    epoch_forget_all();
+    mem_deinit();
+    *head = NULL;
+    legacy_switch(NULL);
+}
+
+// Makes 'list' an empty list
+void list_handle_init(List* list){
+    list->head = NULL;
+    list->tail = NULL;
+    list->count = 0;
+}
+
+// Appends a node with data 'data' behind the tail of 'list', without walking it
+void list_append(List* list, uint16_t data){
+    Node* new_node = node_create(data);
+    if(new_node == NULL)
+        return;
+
+    unsigned long long epoch;
+    epoch_record* record = epoch_enter(&epoch);
+    if(record == NULL){
+        mem_free(new_node);
+        return;
+    }
+    append(&list->head, list, new_node, epoch);
+    epoch_exit(record);
+}
+
+// Delete the first node of 'list' that contains 'data'
+void list_remove(List* list, uint16_t data){
+    unsigned long long epoch;
+    epoch_record* record = epoch_enter(&epoch);
+    if(record == NULL)
+        return;
+    remove_first(&list->head, list, data, record);
+    epoch_exit(record);
+}
+
+// Searches 'list' to find node containing 'data', returns NULL if there is none
+Node* list_find(List* list, uint16_t data){
+    unsigned long long epoch;
+    epoch_record* record = epoch_enter(&epoch);
+    if(record == NULL)
+        return NULL;
+    Node* found = find(&list->head, data);
+    epoch_exit(record);
+    return found;
+}
+
+// Number of nodes in 'list', kept up to date so it doesn't have to be counted
+size_t list_length(List* list){
+    return __atomic_load_n(&list->count, __ATOMIC_RELAXED);
+}
+
+// Frees every node of 'list'. Unlike list_cleanup the memory pool stays as it is.
+// No other thread may be using the list
+void list_handle_cleanup(List* list){
+    free_all(list->head);
+    list_handle_init(list);
+}
+
+#else
+
+// Lists are locked hand over hand: a thread walking a list holds the lock of the node it is at,
+// and takes the lock of the next node before letting go of it. Threads working in different parts
+// of a list don't wait for each other, and none can overtake another on the way there.
+// A List's own lock stands in for a node in front of the head. It guards the head and tail, and is
+// always taken before any node lock, so a thread already holding node locks only tries to take it,
+// backing off and starting over if it is busy
+
+// The Node** functions work on this List, kept for the head they were last called with.
+// Every change to the list goes through this file, so the List stays in step with the
+// nodes, and appending at its tail is O(1). A different head gets the List rebuilt
+static List legacy_list = {NULL, NULL, 0, PTHREAD_MUTEX_INITIALIZER};
+static Node** legacy_head = NULL;
+
+// The kept List's count, with the generation it belongs to in the upper half. Rebuilding it starts
+// a new generation, and tags each node with it on the way. Threads at work elsewhere don't hold the
+// List's lock, so a change they make only counts, or moves the tail, if its node carries the current
+// generation: it is in the kept List and the rebuild has already counted it. Nodes further down get
+// counted as the rebuild gets to them, and nodes of other lists never carry it
+static unsigned long long legacy_count = 1ULL << 32; // Nodes that were never counted carry generation 0
+
+static uint32_t legacy_generation(){
+    return __atomic_load_n(&legacy_count, __ATOMIC_RELAXED) >> 32;
+}
+
+// Whether 'node' is counted in 'list'. A List handle counts all of its nodes
+static bool counted_in(List* list, Node* node){
+    return list != &legacy_list || node->generation == legacy_generation();
+}
+
+// Adds 'delta' to the count of 'list', for a change at 'node'
+static void count_add(List* list, Node* node, long delta){
+    if(list != &legacy_list){
+        __atomic_add_fetch(&list->count, delta, __ATOMIC_RELAXED);
+        return;
+    }
+
+    // The generation is checked and the count changed in one go, so a rebuild can't start in between
+    unsigned long long count = __atomic_load_n(&legacy_count, __ATOMIC_RELAXED);
+    do{
+        if(count >> 32 != node->generation)
+            return;
+    } while(!__atomic_compare_exchange_n(&legacy_count, &count, count + delta, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+#ifdef LIST_COMPACT_NODE
+// The compact node only has room for a one byte spinlock. It is held for a few steps at a time,
+// so a waiting thread yields instead of sleeping
+static void node_lock_init(Node* node){
+    node->lock = 0;
+}
+
+static void node_lock(Node* node){
+    while(__atomic_test_and_set(&node->lock, __ATOMIC_ACQUIRE))
+        sched_yield();
+}
+
+static void node_unlock(Node* node){
+    __atomic_clear(&node->lock, __ATOMIC_RELEASE);
+}
+
+static void node_lock_destroy(Node* node){
+    (void)node;
+}
+#else
+static void node_lock_init(Node* node){
+    pthread_mutex_init(&node->lock, NULL);
+}
+
+static void node_lock(Node* node){
+    pthread_mutex_lock(&node->lock);
+}
+
+static void node_unlock(Node* node){
+    pthread_mutex_unlock(&node->lock);
+}
+
+static void node_lock_destroy(Node* node){
+    pthread_mutex_destroy(&node->lock);
+}
+#endif
+
+// Changes the head of 'list', and with it the head the kept List stands for. Needs the List's lock
+static void set_head(List* list, Node* node){
+    list->head = node;
+    if(list == &legacy_list)
+        *legacy_head = node;
+}
+
+// Returns the List for 'head', rebuilding it by walking the list if it isn't the one kept.
+// Needs the kept List's lock
+static List* list_of(Node** head){
+    if(legacy_head != head || legacy_list.head != *head){
+        legacy_head = head;
+        legacy_list.head = *head;
+        legacy_list.tail = NULL;
+
+        uint32_t generation = legacy_generation() + 1;
+        if(generation == 0)
+            generation = 1;
+        __atomic_store_n(&legacy_count, (unsigned long long)generation << 32, __ATOMIC_RELAXED);
+
+        // Other threads may still be at work further down the list, so walk it hand over hand
+        Node* walker = *head;
+        if(walker != NULL)
+            node_lock(walker);
+        while(walker != NULL){
+            walker->generation = generation;
+            __atomic_add_fetch(&legacy_count, 1, __ATOMIC_RELAXED);
+
+            Node* next = walker->next;
+            if(next != NULL)
+                node_lock(next);
+            node_unlock(walker);
+
+            legacy_list.tail = walker;
+            walker = next;
+        }
+    }
+    return &legacy_list;
+}
+
+// Allocates a node holding 'data', or returns NULL if the pool is full
+static Node* node_create(uint16_t data){
+    Node* new_node = mem_alloc(sizeof(Node));
+    if(new_node == 0){
+        // Can't allocate new node
+        printf("ERROR!");
+        return NULL;
+    }
+    new_node->data = data;
+    new_node->generation = 0;
+    new_node->next = NULL;
+    node_lock_init(new_node);
+    return new_node;
+}
+
+// Frees a node that is no longer reachable from any list
+static void node_destroy(Node* node){
+    node_lock_destroy(node);
+    mem_free(node);
+}
+
+// Links 'new_node' in at the end of 'list'.
+// Called with the List's lock held, which it releases
+static void append(List* list, Node* new_node){
+    if(list == &legacy_list)
+        new_node->generation = legacy_generation();
+    Node* tail = list->tail;
+    if(tail == NULL){
+        set_head(list, new_node);
+    }
+    else{
+        node_lock(tail);
+        tail->next = new_node;
+        node_unlock(tail);
+    }
+    list->tail = new_node;
+    count_add(list, new_node, 1);
+
+    pthread_mutex_unlock(&list->lock);
+}
+
+// Delete the first node of 'list' that contains 'data'.
+// Called with the List's lock held, which it releases. Returns false if it had to back off
+// before finding out, in which case the caller takes the lock again and retries
+static bool remove_first(List* list, uint16_t data){
+    Node* walker = list->head;
+    if(walker == NULL){
+        pthread_mutex_unlock(&list->lock);
+        return true;
+    }
+
+    node_lock(walker);
+    if(walker->data == data){
+        set_head(list, walker->next);
+        if(list->tail == walker)
+            list->tail = NULL;
+        count_add(list, walker, -1);
+
+        node_unlock(walker);
+        pthread_mutex_unlock(&list->lock);
+        node_destroy(walker);
+        return true;
+    }
+    pthread_mutex_unlock(&list->lock);
+
+    // Walk with the previous node locked too, so the one holding 'data' can be unlinked
+    Node* prev = walker;
+    while((walker = prev->next) != NULL){
+        node_lock(walker);
+        if(walker->data == data){
+            // Unlinking the tail moves it back, which needs the List's lock. An appender may hold
+            // that while waiting for this node, so back off instead of waiting for it.
+            // Once the lock was let go, the kept List may have been rebuilt for another list
+            bool is_tail = walker->next == NULL && counted_in(list, walker);
+            if(is_tail && pthread_mutex_trylock(&list->lock) != 0){
+                node_unlock(walker);
+                node_unlock(prev);
+                sched_yield();
+                return false;
+            }
+
+            prev->next = walker->next;
+            if(is_tail){
+                if(counted_in(list, walker))
+                    list->tail = prev;
+                pthread_mutex_unlock(&list->lock);
+            }
+            count_add(list, walker, -1);
+
+            node_unlock(walker);
+            node_unlock(prev);
+            node_destroy(walker);
+            return true;
+        }
+        node_unlock(prev);
+        prev = walker;
+    }
+
+    node_unlock(prev);
+    return true;
+}
+
+// Links 'new_node' in before 'next_node', or at the end if 'next_node' isn't found.
+// Called with the List's lock held, which it releases. Returns false if it had to back off,
+// in which case the caller takes the lock again and retries
+static bool link_before(List* list, Node* next_node, Node* new_node){
+    Node* walker = list->head;
+    if(next_node == walker){
+        //Insert before 'head', which means just insert at beginning of list
+        new_node->generation = legacy_generation();
+        new_node->next = walker;
+        set_head(list, new_node);
+        if(walker == NULL)
+            list->tail = new_node;
+        count_add(list, new_node, 1);
+
+        pthread_mutex_unlock(&list->lock);
+        return true;
+    }
+
+    node_lock(walker);
+    pthread_mutex_unlock(&list->lock);
+
+    // Traverse through the list until it finds the node before 'next_node'
+    while(walker->next != NULL && walker->next != next_node){
+        Node* next = walker->next;
+        node_lock(next);
+        node_unlock(walker);
+        walker = next;
+    }
+
+    // Inserting behind the tail moves it, see remove_first
+    bool is_tail = walker->next == NULL && counted_in(list, walker);
+    if(is_tail && pthread_mutex_trylock(&list->lock) != 0){
+        node_unlock(walker);
+        sched_yield();
+        return false;
+    }
+
+    // Then make new node point to 'next node',
+    // and the node previously pointing to 'next node', to instead point to new node.
+    // It is counted wherever the node in front of it is
+    new_node->generation = walker->generation;
+    new_node->next = next_node;
+    walker->next = new_node;
+    if(is_tail){
+        if(new_node->next == NULL && counted_in(list, walker))
+            list->tail = new_node;
+        pthread_mutex_unlock(&list->lock);
+    }
+    count_add(list, new_node, 1);
+
+    node_unlock(walker);
+    return true;
+}
+
+// Searches the list starting at 'head' to find node containing 'data'.
+// Called with the lock guarding 'head' held, which it releases
+static Node* find(Node* head, pthread_mutex_t* lock, uint16_t data){
+    Node* walker = head;
+    if(walker != NULL)
+        node_lock(walker);
+    pthread_mutex_unlock(lock);
+
+    while(walker != NULL && walker->data != data){
+        Node* next = walker->next;
+        if(next != NULL)
+            node_lock(next);
+        node_unlock(walker);
+        walker = next;
+    }
+
+    if(walker != NULL)
+        node_unlock(walker);
+    return walker;
+}
+
+// Frees every node of the list starting at 'head'. Called with the lock guarding it held
+static void free_all(Node* head){
+    Node* walker = head;
     while(walker != NULL){
         Node* toDel = walker;
         walker = walker->next;
 
-        mem_free(toDel);
+        node_destroy(toDel);
+    }
+}
+
+// Initializes the list by intiliazing the memory_manager with a memory pool of 'size'
+void list_init(Node** head, size_t size){
+    mem_init(size);
+
+    pthread_mutex_lock(&legacy_list.lock);
+    *head = NULL;
+    legacy_head = NULL;
+    legacy_list.head = NULL;
+    legacy_list.tail = NULL;
+    pthread_mutex_unlock(&legacy_list.lock);
+}
+
+// Inserts new node with data of 'data' at the end of list
+void list_insert(Node** head, uint16_t data){
+    Node* new_node = node_create(data);
+    if(new_node == NULL)
+        return;
+
+    pthread_mutex_lock(&legacy_list.lock);
+    append(list_of(head), new_node);
+}
+
+// Inserts a new node inbetween prev_node and prev_node->next
+void list_insert_after(Node* prev_node, uint16_t  data){
+    Node* new_node = node_create(data);
+    if(new_node == NULL)
+        return;
+
+    // Only 'prev_node' has to be locked, unless it is the tail of the kept List,
+    // which then has to be moved, see remove_first
+    bool is_tail;
+    for(;;){
+        node_lock(prev_node);
+        is_tail = prev_node->next == NULL && counted_in(&legacy_list, prev_node);
+        if(!is_tail || pthread_mutex_trylock(&legacy_list.lock) == 0)
+            break;
+        node_unlock(prev_node);
+        sched_yield();
+    }
+
+    // The new node is counted wherever 'prev_node' is
+    new_node->generation = prev_node->generation;
+    new_node->next = prev_node->next;
+    prev_node->next = new_node;
+    if(is_tail){
+        if(counted_in(&legacy_list, prev_node) && legacy_list.tail == prev_node)
+            legacy_list.tail = new_node;
+        pthread_mutex_unlock(&legacy_list.lock);
+    }
+    count_add(&legacy_list, new_node, 1);
+    node_unlock(prev_node);
+}
+
+// Insert node with data 'data' before node 'next_node'.
+// Uses 'head' to start traversing through the list
+void list_insert_before(Node** head, Node* next_node, uint16_t  data){
+    Node* new_node = node_create(data);
+    if(new_node == NULL)
+        return;
+
+    do{
+        pthread_mutex_lock(&legacy_list.lock);
+    } while(!link_before(list_of(head), next_node, new_node));
+}
+
+// Delete the first node that contains 'data'
+void list_delete(Node** head, uint16_t  data){
+    for(;;){
+        pthread_mutex_lock(&legacy_list.lock);
+        if(*head == NULL){
+            printf("ERROR: Deleting from empty list!");
+            pthread_mutex_unlock(&legacy_list.lock);
+            return;
+        }
+        if(remove_first(list_of(head), data))
+            return;
+    }
+}
+
+// Searches the list to find node containing 'data'
+Node* list_search(Node** head, uint16_t  data){
+    // If the list is empty, immediately return NULL
+    if(head == NULL){
+        printf("ERROR: head is null");
+        return NULL;
+    }
+
+    // Traverses through the list
+    pthread_mutex_lock(&legacy_list.lock);
+    Node* walker = find(*head, &legacy_list.lock, data);
+
+    if (walker == NULL){
+        // If it walks through the entire list and can't find 'data',
+        // then it doesn't exists, so return NULL
+        printf("ERROR: can't find data.");
+        return NULL;
+    }
+    else{
+        return walker;
+    }
+}
+
+// To display the whole list, just call list_display_range() with the range of the whole list
+void list_display(Node** head){
+    return list_display_range(head, NULL, NULL);
+}
+
+// Displays the entire list in format [0, 1, 2, 3, etc]
+void list_display_range(Node** head, Node* start_node, Node* end_node){
+    // By default, traversing starts at head,
+    // but if 'start node' is specified, start there instead
+    Node* walker = start_node;
+    if(walker == NULL){
+        pthread_mutex_lock(&legacy_list.lock);
+        walker = *head;
+        node_lock(walker);
+        pthread_mutex_unlock(&legacy_list.lock);
     }
+    else{
+        node_lock(walker);
+    }
+
+    printf("[");
+    printf("%d", walker->data);
+    // Walk through list and print until we reach either 'end_node' or NULL
+    while(walker->next != NULL && walker != end_node){
+        Node* next = walker->next;
+        node_lock(next);
+        node_unlock(walker);
+        walker = next;
+        printf(", %d", walker->data);
+    }
+    printf("]");
+
+    node_unlock(walker);
+}
+
+// Counts amount of nodes in list. The kept List already knows, so the list is only
+// walked when that has to be rebuilt
+int list_count_nodes(Node** head){
+    pthread_mutex_lock(&legacy_list.lock);
+    list_of(head);
+    int count = (uint32_t)__atomic_load_n(&legacy_count, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&legacy_list.lock);
+
+    return count;
+}
+
+// Deinitializes the list, by freeing all related memory
+void list_cleanup(Node** head){
+    pthread_mutex_lock(&legacy_list.lock);
+
+    // This is unneccessary
+    free_all(*head);
 
     // Deinitializes the memory
     mem_deinit();
     *head = NULL;
+    legacy_head = NULL;
+    legacy_list.head = NULL;
+    legacy_list.tail = NULL;
 
-    pthread_rwlock_unlock(&rw_lock);
-    //pthread_rwlock_destroy(&lock);
+    pthread_mutex_unlock(&legacy_list.lock);
 }
+
+// Makes 'list' an empty list
+void list_handle_init(List* list){
+    list->head = NULL;
+    list->tail = NULL;
+    list->count = 0;
+    pthread_mutex_init(&list->lock, NULL);
+}
+
+// Appends a node with data 'data' behind the tail of 'list', without walking it
+void list_append(List* list, uint16_t data){
+    Node* new_node = node_create(data);
+    if(new_node == NULL)
+        return;
+
+    pthread_mutex_lock(&list->lock);
+    append(list, new_node);
+}
+
+// Delete the first node of 'list' that contains 'data'
+void list_remove(List* list, uint16_t data){
+    do{
+        pthread_mutex_lock(&list->lock);
+    } while(!remove_first(list, data));
+}
+
+// Searches 'list' to find node containing 'data', returns NULL if there is none
+Node* list_find(List* list, uint16_t data){
+    pthread_mutex_lock(&list->lock);
+    return find(list->head, &list->lock, data);
+}
+
+// Number of nodes in 'list', kept up to date so it doesn't have to be counted
+size_t list_length(List* list){
+    return __atomic_load_n(&list->count, __ATOMIC_RELAXED);
+}
+
+// Frees every node of 'list'. Unlike list_cleanup the memory pool stays as it is
+void list_handle_cleanup(List* list){
+    pthread_mutex_lock(&list->lock);
+    free_all(list->head);
+    list->head = NULL;
+    list->tail = NULL;
+    list->count = 0;
+    pthread_mutex_unlock(&list->lock);
+}
+
+#endif // LIST_LOCK_FREE
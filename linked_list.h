@@ -5,14 +5,36 @@
 #include "memory_manager.h" // Include your custom memory manager
 #include <stdint.h>
 // #include <pthread.h>
+// Building with -DLIST_COMPACT_NODE swaps the node's mutex for a one byte spinlock in the padding
+// after 'data', which shrinks Node from 56 to 16 bytes on x86-64, so a pool of a given size holds
+// 3.5 times as many nodes.
+// Building with -DLIST_LOCK_FREE makes the lists lock-free instead, and leaves the lock out altogether
 typedef struct Node
 {
-    uint16_t data;     // Stores the data as an unsigned 16-bit integer
-    struct Node *next; // Pointer to the next node in the list
-    pthread_mutex_t lock;
+    uint16_t data; // Stores the data as an unsigned 16-bit integer
+#if defined(LIST_COMPACT_NODE) && !defined(LIST_LOCK_FREE)
+    uint8_t lock;
+#endif
+    uint32_t generation; // Generation of the kept List the node is known to be in, see linked_list.c. Fits in the padding
+    struct Node *next; // Pointer to the next node in the list. Under LIST_LOCK_FREE its lowest bit marks the node deleted
+#if !defined(LIST_COMPACT_NODE) && !defined(LIST_LOCK_FREE)
+    pthread_mutex_t lock; // Taken while a thread is at this node, see linked_list.c
+#endif
 
 } Node;
 
+// A list that keeps track of its last node and its length, so appending and
+// counting don't have to walk it. The Node** functions below use one internally
+typedef struct List
+{
+    Node *head;
+    Node *tail;           // Last node of the list, NULL when it is empty. Only a hint under LIST_LOCK_FREE
+    size_t count;         // Number of nodes in the list
+#ifndef LIST_LOCK_FREE
+    pthread_mutex_t lock; // Guards head and tail, and is taken before any node lock
+#endif
+} List;
+
 // Function declarations
 void list_init(Node **head, size_t size);
 void list_insert(Node **head, uint16_t data);
@@ -27,4 +49,13 @@ void list_display_range(Node **head, Node *start_node, Node *end_node);
 int list_count_nodes(Node **head);
 void list_cleanup(Node **head);
 
+// List handle functions. The memory pool has to be set up with list_init or mem_init first,
+// and a List's nodes should only be changed through these
+void list_handle_init(List *list);
+void list_append(List *list, uint16_t data);
+void list_remove(List *list, uint16_t data);
+Node *list_find(List *list, uint16_t data);
+size_t list_length(List *list);
+void list_handle_cleanup(List *list);
+
 #endif // LINKED_LIST_H
@@ -1,249 +1,2696 @@
-#include "memory_manager.h"
-
-// For testing:
-// #define DEBUG_MODE 1
-
-#ifdef DEBUG_MODE
-    #define DEBUG(x) x
-#else
-    #define DEBUG(x)
-#endif
-
-pthread_mutex_t lock;
-
-void* memory;
-size_t s;
-
-memory_block* memory_block_head;
-int block_count = 0;
-
-// Initializes the memory manager, with a memory pool of size amount of bytes
-void mem_init(size_t size){
-    DEBUG(printf("mem_init: %lu ", size));
-
-    // Creates recursive attribute for the mutex,
-    // which is important for the mem_resize() function
-    pthread_mutexattr_t recursive_attr;
-    pthread_mutexattr_init(&recursive_attr);
-    pthread_mutexattr_settype(&recursive_attr, PTHREAD_MUTEX_RECURSIVE);
-
-    // Initialize the mutex lock with attribute
-    pthread_mutex_init(&lock, &recursive_attr);
-
-    memory = malloc(size);
-    s = size;
-
-    memory_block_head = malloc(sizeof(memory_block));
-
-    *memory_block_head = (memory_block) {memory, s, true, NULL};
-    block_count = 1;
-}
-
-void* mem_alloc(size_t size){
-    pthread_mutex_lock(&lock);
-
-    DEBUG(printf("mem_alloc: %lu ", size));
-
-    //Walk through all memory blocks, trying to find a memory block that is large enough and free
-    memory_block* walker = memory_block_head;
-    while(walker != NULL && (!walker->free || walker->block_size < size)){
-        walker = walker->next;
-    }
-
-    //If it rejected all existing memory blocks, allocation is impossible
-    if(walker == NULL){
-        printf("ERROR, no space in memory! \n");
-        pthread_mutex_unlock(&lock);
-        return NULL;
-    }
-    
-    if(walker->block_size == size){
-        // If the chosen memory block is the exact size to allocate, 
-        // just mark it as allocated
-        walker->free = false;
-    }
-    else{
-        // Change the size of the chosen memory block, and fill out the rest of
-        // the space it previously occupied with a new empty memory block
-
-        block_count++;
-        
-        // Create new memoryblock that starts at i.start + size
-        void* new_start = (void*)((char*)walker->start + size);
-        memory_block* new_block = malloc(sizeof(memory_block));
-        *new_block = (memory_block){new_start, walker->block_size - size, true, walker->next};
-        walker->next = new_block;
-
-        // Change old memory block size to allocated size
-        walker->block_size = size;
-
-        // Mark old memory block as allocated
-        walker->free = false;
-    }    
-
-    DEBUG(printf("at %lu ", (size_t)walker->start));
-    pthread_mutex_unlock(&lock);
-    return walker->start;
-}
-
-void mem_free(void* block){
-    pthread_mutex_lock(&lock);
-
-    DEBUG(printf("memfree: %lu ", (size_t)block));
-
-    // Check if block is uninitiliazed
-    if(block == NULL){
-        pthread_mutex_unlock(&lock);
-        return;
-    }
-
-    // Default case
-    memory_block* block_to_free = memory_block_head;
-    memory_block* block_preceding = NULL;
-
-    // If block is not memory_block_head
-    if(block_to_free->start != block){
-        memory_block* walker = memory_block_head;
-        while(walker != NULL && walker->next != NULL && ((memory_block*)walker->next)->start != block) {
-            walker = walker->next;
-        }
-
-        // If it can't find the block, just return
-        if(walker == NULL || walker->next == NULL){
-            printf("ERROR, no such block to free! \n");
-            pthread_mutex_unlock(&lock);
-            return;
-        }
-
-        block_to_free = walker->next;
-        block_preceding = walker;
-    }
-
-    // If the specified block was already free, just return
-    if(block_to_free->free){
-        pthread_mutex_unlock(&lock);
-        return;
-    }
-
-    //Free the block
-    block_to_free->free = true;
-
-
-
-    // Memory merging:
-
-    // Merge with previous block
-    if(block_preceding != NULL && block_preceding->free){
-        block_preceding->next = block_to_free->next;
-        block_preceding->block_size += block_to_free->block_size;
-        block_count--;
-        free(block_to_free);
-        block_to_free = block_preceding;
-    }
-
-    // Merge with next block
-    memory_block* next_block = ((memory_block*)block_to_free->next);
-    if(next_block != NULL && next_block->free){
-        block_to_free->next = next_block->next;
-        block_to_free->block_size += next_block->block_size;
-        free(next_block);
-        block_count--;
-    }
-
-    pthread_mutex_unlock(&lock);
-}
-
-// Changes size of block
-void* mem_resize(void* block, size_t size){
-    pthread_mutex_lock(&lock);
-    
-    DEBUG(printf("mem_resize: %lu ", size));
-
-    memory_block* block_to_resize = memory_block_head;
-    memory_block* block_preceding = NULL;
-
-    if(block_to_resize->start != block){
-        memory_block* walker = memory_block_head;
-        while(walker != NULL && walker->next != NULL && ((memory_block*)walker->next)->start != block) {
-            walker = walker->next;
-        }
-
-        // If it can't find the block, just return
-        if(walker == NULL || walker->next == NULL){
-            printf("ERROR, no such block to free! \n");
-            pthread_mutex_unlock(&lock);
-            return NULL;
-        }
-
-        block_to_resize = walker->next;
-        block_preceding = walker;
-    }
-
-    // Resizing forward
-    memory_block* block_after = block_to_resize->next;
-    if (block_after != NULL && block_after->free && block_after->block_size + block_to_resize->block_size >= size){
-        block_to_resize->next = block_after->next;
-        block_to_resize->block_size += block_after->block_size;
-        block_count--;
-        free(block_after);
-
-        DEBUG(printf("Resized forward "));
-
-        pthread_mutex_unlock(&lock);
-        return block_to_resize->start;
-    }
-    // Resizing backward
-    else if(block_preceding != NULL && block_preceding->free && block_preceding->block_size + block_to_resize->block_size >= size){
-        block_preceding->next = block_to_resize->next;
-        block_preceding->block_size += block_to_resize->block_size;
-        block_count--;
-
-        //Move the data
-        memmove(block_preceding->start, block, block_to_resize->block_size);
-
-        DEBUG(printf("Old address: %lu, new address: %lu.", (size_t)block_to_resize->start, (size_t)block_preceding->start));
-
-        free(block_to_resize);
-
-        DEBUG(printf("Resized backward "));
-
-        pthread_mutex_unlock(&lock);
-        return block_preceding->start;
-    }
-    else{
-        // Allocate new block
-        void* new_block = mem_alloc(size);
-        if(new_block != NULL){
-            // Copy the data
-            memcpy(new_block, block, block_to_resize->block_size);
-
-            // Delete old block
-            mem_free(block);
-
-            // Return the new block
-            pthread_mutex_unlock(&lock);
-            return new_block;
-        }
-        else{
-            printf("ERROR: No space for resized block!");
-            pthread_mutex_unlock(&lock);
-            return NULL;
-        }
-    }
-}
-
-// Frees all memory that was allocated using malloc
-void mem_deinit(){
-    DEBUG(printf("mem_deinit "));
-
-    free(memory);
-    
-    memory_block* walker_of_death = memory_block_head;
-    while(walker_of_death != NULL) {
-        memory_block* to_del = walker_of_death;
-        walker_of_death = walker_of_death->next;
-        free(to_del);
-    }
-
-    pthread_mutex_destroy(&lock);
-}
\ No newline at end of file
+#include "memory_manager.h"
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+// For testing:
+// #define DEBUG_MODE 1
+
+#ifdef DEBUG_MODE
+    #define DEBUG(x) x
+#else
+    #define DEBUG(x)
+#endif
+
+// One size class per power of two, class k holds free blocks of size [2^k, 2^(k+1))
+#define SIZE_CLASS_COUNT 64
+
+#define BLOCK_TABLE_INITIAL_SIZE 64
+
+// Freed blocks a thread keeps per size class before handing them back to the shared pool
+#define THREAD_CACHE_SLOTS 8
+// Buckets in a thread's table of blocks it handed out from its cache, kept at most half full
+#define THREAD_CACHE_LENT_SIZE 128
+
+// Descriptors in the first descriptor chunk, every further chunk is twice as large as the last
+#define DESCRIPTOR_CHUNK_INITIAL_SIZE 64
+
+// Mapped pools return the pages of free blocks at least this large to the OS, unless told otherwise
+#define DEFAULT_RELEASE_THRESHOLD (1 << 20)
+#define HUGE_PAGE_SIZE (2 << 20)
+
+// Slots in the first handle table, every growth doubles it
+#define HANDLE_TABLE_INITIAL_SIZE 64
+// Bytes the background compactor moves per hold of the pool lock
+#define COMPACT_STEP_BYTES (64 << 10)
+
+// Block descriptors are carved from chunks that are only ever added, never freed before
+// the arena is torn down, so splitting and merging blocks doesn't go through the system heap
+typedef struct descriptor_chunk{
+    struct descriptor_chunk* next_chunk;
+    size_t count;
+    memory_block descriptors[];
+} descriptor_chunk;
+
+// Per thread cache of recently freed blocks. Cached blocks still count as allocated in the
+// shared pool, so the thread can hand them out and take them back under its own lock only.
+// 'lock' is only contended when another thread frees one of the blocks or drains the cache.
+typedef struct thread_cache{
+    pthread_mutex_t lock;
+    memory_block* bins[SIZE_CLASS_COUNT][THREAD_CACHE_SLOTS];
+    int bin_count[SIZE_CLASS_COUNT];
+
+    // Blocks handed out from the bins, hashed by start address with linear probing
+    memory_block* lent[THREAD_CACHE_LENT_SIZE];
+    int lent_count;
+
+    // Allocations and frees served by the cache alone, for mem_stats. Only changed by the cache's
+    // own thread, and atomic so mem_stats can read them without taking 'lock'
+    unsigned long long allocs;
+    unsigned long long frees;
+
+    mem_arena* arena; // The arena whose blocks the cache holds
+    struct thread_cache* next_cache;
+    struct thread_cache* prev_cache;
+} thread_cache;
+
+// Latency measured by the threads of an instrumented arena, one recorder per thread so recording
+// never contends. Other threads only touch a recorder to take a snapshot or reset it
+typedef struct latency_recorder{
+    mem_latency latency;
+    mem_arena* arena;
+    struct latency_recorder* next_recorder;
+    struct latency_recorder* prev_recorder;
+} latency_recorder;
+
+// Slot of an arena's handle table. Free slots are chained through 'next_free'
+typedef struct handle_entry{
+    memory_block* block;     // NULL while the slot is free
+    unsigned int generation; // Bumped whenever the slot is freed, so stale handles are rejected
+    unsigned int pins;       // Outstanding mem_hlock calls, the block is not moved while there are any
+    unsigned int next_free;  // Index + 1 of the next free slot, 0 at the end of the chain
+} handle_entry;
+
+// Everything one memory pool consists of. Arenas share nothing, so each has its own lock
+struct mem_arena{
+    // Searches and queries that change nothing share the lock, everything else takes it exclusively
+    pthread_rwlock_t lock;
+
+    void* memory;
+    size_t size;
+    bool owns_memory; // Shards use part of their arena's pool instead of a pool of their own
+
+    // Length of the pool's mapping and the page size it is released in, 0 for malloc'd pools
+    size_t mapped_size;
+    size_t release_page_size;
+
+    memory_block* memory_block_head;
+    int block_count;
+
+    mem_options options;
+
+    // Where the next next-fit search starts
+    memory_block* next_fit_rover;
+
+    // Root of the best fit index, a treap of the free blocks (only kept under MEM_POLICY_BEST_FIT)
+    memory_block* free_tree_root;
+
+    // Free blocks segregated by size class, and a bitmap of which classes are non-empty
+    memory_block* free_lists[SIZE_CLASS_COUNT];
+    unsigned long long free_list_map;
+    // Size of the largest block in each class, and how many blocks of that size it holds, so mem_stats
+    // doesn't have to search for it. A count of 0 in a non-empty class means the size is out of date
+    size_t free_list_largest[SIZE_CLASS_COUNT];
+    size_t free_list_largest_count[SIZE_CLASS_COUNT];
+
+    // Allocated blocks hashed by their start address, so a pointer leads
+    // straight to its block instead of through a walk from memory_block_head
+    memory_block** block_table;
+    size_t block_table_size;
+    size_t block_table_count;
+
+    descriptor_chunk* descriptor_chunks;
+    memory_block* free_descriptors; // Unused descriptors, linked through their 'next' field
+    size_t descriptor_chunk_size;   // Size of the next chunk to be added
+
+    // Every live thread cache, so they can be drained when the shared pool runs dry.
+    // The key is only created while thread caches are enabled
+    thread_cache* thread_caches;
+    pthread_key_t thread_cache_key;
+
+    // Running totals behind mem_stats, kept up to date as blocks change so a query costs next to nothing
+    size_t free_bytes;
+    size_t free_block_count;
+    unsigned long long allocs;
+    unsigned long long frees;
+    unsigned long long resizes;
+    unsigned long long alloc_failures;
+    unsigned long long free_failures;
+    unsigned long long resize_failures;
+
+    // Recorders of the live threads, and the latency recorded by threads that exited (MEM_INSTRUMENT only)
+    pthread_mutex_t latency_lock;
+    latency_recorder* latency_recorders;
+    mem_latency* retired_latency;
+    pthread_key_t latency_key;
+
+    mem_error_callback error_callback;
+    void* error_callback_data;
+
+    // Blocks allocated through handles, the only ones compaction may move
+    handle_entry* handles;
+    unsigned int handle_capacity;
+    unsigned int free_handle; // Index + 1 of the first free slot, 0 if there is none
+
+    // Background compaction thread, 'compactor_lock' guards the fields below it
+    pthread_t compactor;
+    pthread_mutex_t compactor_lock;
+    pthread_cond_t compactor_wake;
+    bool compactor_running;
+    unsigned int compactor_interval_ms;
+
+    // A sharded arena splits its pool into shards, which are arenas of their own. The shards hold all
+    // blocks, so the sharded arena only routes calls to them. 'parent' leads from a shard to its arena
+    struct mem_arena* shards;
+    unsigned int shard_count;
+    struct mem_arena* parent;
+};
+
+// The error of the calling thread's last failed call
+static _Thread_local mem_error last_error = MEM_OK;
+
+// Threads are numbered as they first allocate from a sharded arena, which spreads them evenly over its shards
+static _Thread_local unsigned int thread_number = 0;
+static unsigned int thread_count = 0;
+
+// Timestamps of a single call while it is being measured
+typedef struct op_timer{
+    bool on;
+    bool used_lock;
+    unsigned long long start;
+    unsigned long long lock_wait;  // Time spent waiting for the pool lock so far
+    unsigned long long lock_held;  // Time spent holding the pool lock so far
+    unsigned long long lock_taken; // When the pool lock was last taken
+} op_timer;
+
+// The arena behind mem_init, mem_alloc and the other mem_* functions
+static mem_arena default_arena;
+
+// Bumps an operation counter of an arena. Some are bumped without the arena lock, so all of them are atomic
+static void count_op(unsigned long long* counter, unsigned long long amount){
+    __atomic_fetch_add(counter, amount, __ATOMIC_RELAXED);
+}
+
+// Records a failed call of operation 'op' for mem_stats and mem_last_error, and passes it on to the arena's
+// callback. MEM_OP_COUNT stands for calls that aren't counted, like those on slabs.
+// Must be called without the arena lock, as the callback may well do slow things like printing
+static void report_error(mem_arena* arena, mem_op op, mem_error error, void* block, size_t size){
+    last_error = error;
+
+    // Shards fail quietly, the arena they belong to decides whether the call failed as a whole
+    if(arena->parent != NULL)
+        return;
+
+    if(op == MEM_OP_ALLOC)
+        count_op(&arena->alloc_failures, 1);
+    else if(op == MEM_OP_FREE)
+        count_op(&arena->free_failures, 1);
+    else if(op == MEM_OP_RESIZE)
+        count_op(&arena->resize_failures, 1);
+
+    if(arena->error_callback != NULL)
+        arena->error_callback(error, block, size, arena->error_callback_data);
+}
+
+// Returns the size class of a block of 'size' bytes, i.e. floor(log2(size))
+static int size_class(size_t size){
+    return SIZE_CLASS_COUNT - 1 - __builtin_clzll((unsigned long long)size);
+}
+
+// Mixes the bits of an address, so evenly spaced blocks still get well spread hashes
+static unsigned long long address_hash(void* start){
+    unsigned long long hash = (unsigned long long)(size_t)start;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Orders the best fit index by size, and blocks of the same size by address
+static bool free_tree_less(memory_block* a, memory_block* b){
+    if(a->block_size != b->block_size)
+        return a->block_size < b->block_size;
+    return (size_t)a->start < (size_t)b->start;
+}
+
+// Treap priorities are derived from the address, so they need no storage and look random
+static unsigned long long free_tree_priority(memory_block* block){
+    return address_hash(block->start);
+}
+
+static memory_block* free_tree_insert(memory_block* root, memory_block* block){
+    if(root == NULL){
+        block->tree_left = NULL;
+        block->tree_right = NULL;
+        return block;
+    }
+
+    // Insert into the matching subtree, then rotate the new block up while it outranks its parent
+    if(free_tree_less(block, root)){
+        root->tree_left = free_tree_insert(root->tree_left, block);
+        if(free_tree_priority(root->tree_left) > free_tree_priority(root)){
+            memory_block* child = root->tree_left;
+            root->tree_left = child->tree_right;
+            child->tree_right = root;
+            root = child;
+        }
+    }
+    else{
+        root->tree_right = free_tree_insert(root->tree_right, block);
+        if(free_tree_priority(root->tree_right) > free_tree_priority(root)){
+            memory_block* child = root->tree_right;
+            root->tree_right = child->tree_left;
+            child->tree_left = root;
+            root = child;
+        }
+    }
+
+    return root;
+}
+
+// Joins two treaps where every block of 'left' orders before every block of 'right'
+static memory_block* free_tree_join(memory_block* left, memory_block* right){
+    if(left == NULL)
+        return right;
+    if(right == NULL)
+        return left;
+
+    if(free_tree_priority(left) > free_tree_priority(right)){
+        left->tree_right = free_tree_join(left->tree_right, right);
+        return left;
+    }
+    right->tree_left = free_tree_join(left, right->tree_left);
+    return right;
+}
+
+static memory_block* free_tree_remove(memory_block* root, memory_block* block){
+    if(root == block){
+        memory_block* joined = free_tree_join(block->tree_left, block->tree_right);
+        block->tree_left = NULL;
+        block->tree_right = NULL;
+        return joined;
+    }
+
+    if(free_tree_less(block, root))
+        root->tree_left = free_tree_remove(root->tree_left, block);
+    else
+        root->tree_right = free_tree_remove(root->tree_right, block);
+    return root;
+}
+
+// Adds a free block to the front of its size class list
+static void free_list_insert(mem_arena* arena, memory_block* block){
+    int class = size_class(block->block_size);
+
+    block->prev_free = NULL;
+    block->next_free = arena->free_lists[class];
+    if(arena->free_lists[class] != NULL)
+        arena->free_lists[class]->prev_free = block;
+    arena->free_lists[class] = block;
+
+    arena->free_list_map |= 1ULL << class;
+    if(block->block_size > arena->free_list_largest[class]){
+        arena->free_list_largest[class] = block->block_size;
+        arena->free_list_largest_count[class] = 1;
+    }
+    else if(block->block_size == arena->free_list_largest[class]){
+        arena->free_list_largest_count[class]++;
+    }
+    arena->free_bytes += block->block_size;
+    arena->free_block_count++;
+
+    if(arena->options.policy == MEM_POLICY_BEST_FIT)
+        arena->free_tree_root = free_tree_insert(arena->free_tree_root, block);
+}
+
+// Unlinks a block from its size class list, must be called before its size changes
+static void free_list_remove(mem_arena* arena, memory_block* block){
+    int class = size_class(block->block_size);
+
+    if(block->prev_free != NULL)
+        block->prev_free->next_free = block->next_free;
+    else
+        arena->free_lists[class] = block->next_free;
+
+    if(block->next_free != NULL)
+        block->next_free->prev_free = block->prev_free;
+
+    if(arena->free_lists[class] == NULL)
+        arena->free_list_map &= ~(1ULL << class);
+    arena->free_bytes -= block->block_size;
+
+    // Taking out the last block of the largest size leaves the next largest to be found by mem_stats,
+    // so allocating doesn't search the class
+    if(block->block_size == arena->free_list_largest[class] && arena->free_list_largest_count[class] > 0)
+        arena->free_list_largest_count[class]--;
+    if(arena->free_lists[class] == NULL){
+        arena->free_list_largest[class] = 0;
+        arena->free_list_largest_count[class] = 0;
+    }
+    arena->free_block_count--;
+
+    block->prev_free = NULL;
+    block->next_free = NULL;
+
+    if(arena->options.policy == MEM_POLICY_BEST_FIT)
+        arena->free_tree_root = free_tree_remove(arena->free_tree_root, block);
+}
+
+// Segregated fit: a block from the smallest size class that is sure to fit
+static memory_block* find_segregated_fit(mem_arena* arena, size_t size){
+    int class = size_class(size);
+
+    // The most recently freed block of the right class is the cheapest good fit
+    memory_block* candidate = arena->free_lists[class];
+    if(candidate != NULL && candidate->block_size >= size)
+        return candidate;
+
+    // Any block in a larger class is guaranteed to fit, so take the smallest such class
+    unsigned long long larger = class + 1 < SIZE_CLASS_COUNT ? arena->free_list_map & (~0ULL << (class + 1)) : 0;
+    if(larger != 0)
+        return arena->free_lists[__builtin_ctzll(larger)];
+
+    // Otherwise the only candidates left are the rest of the request's own class
+    while(candidate != NULL && candidate->block_size < size){
+        candidate = candidate->next_free;
+    }
+
+    return candidate;
+}
+
+// First fit: the lowest addressed free block that fits
+static memory_block* find_first_fit(mem_arena* arena, size_t size){
+    memory_block* walker = arena->memory_block_head;
+    while(walker != NULL && (!walker->free || walker->block_size < size)){
+        walker = walker->next;
+    }
+    return walker;
+}
+
+// Next fit: like first fit, but starting where the previous allocation was made
+// and wrapping around, so the small fragments at the front aren't rescanned every time
+static memory_block* find_next_fit(mem_arena* arena, size_t size){
+    memory_block* start = arena->next_fit_rover != NULL ? arena->next_fit_rover : arena->memory_block_head;
+    memory_block* walker = start;
+    do{
+        if(walker->free && walker->block_size >= size)
+            return walker;
+
+        walker = walker->next != NULL ? walker->next : arena->memory_block_head;
+    } while(walker != start);
+
+    return NULL;
+}
+
+// Best fit: the smallest free block that fits, found in the best fit index in O(log n).
+// Among equally sized blocks the lowest addressed one wins
+static memory_block* find_best_fit(mem_arena* arena, size_t size){
+    memory_block* best = NULL;
+    memory_block* walker = arena->free_tree_root;
+    while(walker != NULL){
+        if(walker->block_size >= size){
+            best = walker;
+            walker = walker->tree_left;
+        }
+        else{
+            walker = walker->tree_right;
+        }
+    }
+    return best;
+}
+
+// Finds a free block that can hold 'size' bytes according to the placement policy, or NULL if there is none
+static memory_block* find_free_block(mem_arena* arena, size_t size){
+    switch(arena->options.policy){
+    case MEM_POLICY_FIRST_FIT:
+        return find_first_fit(arena, size);
+    case MEM_POLICY_NEXT_FIT:
+        return find_next_fit(arena, size);
+    case MEM_POLICY_BEST_FIT:
+        return find_best_fit(arena, size);
+    default:
+        return find_segregated_fit(arena, size);
+    }
+}
+
+// Returns the bucket of 'start' in a lookup table with 'table_size' (a power of two) buckets
+static size_t block_table_index(void* start, size_t table_size){
+    return (size_t)address_hash(start) & (table_size - 1);
+}
+
+// Doubles the number of buckets once the table holds more blocks than buckets
+static void block_table_grow(mem_arena* arena){
+    size_t new_size = arena->block_table_size * 2;
+    memory_block** new_table = calloc(new_size, sizeof(memory_block*));
+
+    // Without a bigger table the old one still works, just with longer chains
+    if(new_table == NULL)
+        return;
+
+    for(size_t i = 0; i < arena->block_table_size; i++){
+        memory_block* walker = arena->block_table[i];
+        while(walker != NULL){
+            memory_block* to_move = walker;
+            walker = walker->hash_next;
+
+            size_t index = block_table_index(to_move->start, new_size);
+            to_move->hash_next = new_table[index];
+            new_table[index] = to_move;
+        }
+    }
+
+    free(arena->block_table);
+    arena->block_table = new_table;
+    arena->block_table_size = new_size;
+}
+
+// Registers an allocated block so mem_free and mem_resize can find it
+static void block_table_insert(mem_arena* arena, memory_block* block){
+    if(arena->block_table_count >= arena->block_table_size)
+        block_table_grow(arena);
+
+    size_t index = block_table_index(block->start, arena->block_table_size);
+    block->hash_next = arena->block_table[index];
+    arena->block_table[index] = block;
+    arena->block_table_count++;
+}
+
+// Returns the allocated block starting at 'start', or NULL if there is none
+static memory_block* block_table_find(mem_arena* arena, void* start){
+    memory_block* walker = arena->block_table[block_table_index(start, arena->block_table_size)];
+    while(walker != NULL && walker->start != start){
+        walker = walker->hash_next;
+    }
+    return walker;
+}
+
+// Unregisters an allocated block, e.g. when it is freed or moved
+static void block_table_remove(mem_arena* arena, memory_block* block){
+    memory_block** link = &arena->block_table[block_table_index(block->start, arena->block_table_size)];
+    while(*link != block){
+        link = &(*link)->hash_next;
+    }
+    *link = block->hash_next;
+    block->hash_next = NULL;
+    arena->block_table_count--;
+}
+
+// Adds a chunk of unused descriptors, returns false if the system heap is out of memory
+static bool descriptor_chunk_add(mem_arena* arena){
+    descriptor_chunk* chunk = malloc(sizeof(descriptor_chunk) + arena->descriptor_chunk_size * sizeof(memory_block));
+    if(chunk == NULL)
+        return false;
+
+    chunk->count = arena->descriptor_chunk_size;
+    chunk->next_chunk = arena->descriptor_chunks;
+    arena->descriptor_chunks = chunk;
+
+    for(size_t i = 0; i < chunk->count; i++){
+        chunk->descriptors[i].next = arena->free_descriptors;
+        arena->free_descriptors = &chunk->descriptors[i];
+    }
+
+    arena->descriptor_chunk_size *= 2;
+    return true;
+}
+
+// Takes an unused descriptor, adding a chunk only when all of them are in use
+static memory_block* descriptor_alloc(mem_arena* arena){
+    if(arena->free_descriptors == NULL && !descriptor_chunk_add(arena))
+        return NULL;
+
+    memory_block* descriptor = arena->free_descriptors;
+    arena->free_descriptors = descriptor->next;
+    return descriptor;
+}
+
+static void descriptor_free(mem_arena* arena, memory_block* descriptor){
+    // An optimistic search may still hold on to the descriptor, make sure it no longer looks like a free block
+    descriptor->free = false;
+    descriptor->block_size = 0;
+    descriptor->next = arena->free_descriptors;
+    arena->free_descriptors = descriptor;
+}
+
+// Splits the bytes of 'block' past its first 'size' off into a free block of their own, which is
+// left out of the free lists. Returns NULL, leaving the block whole, if there is no descriptor
+static memory_block* split_off_block(mem_arena* arena, memory_block* block, size_t size){
+    memory_block* new_block = descriptor_alloc(arena);
+    if(new_block == NULL)
+        return NULL;
+
+    arena->block_count++;
+
+    // Create new memoryblock that starts at block.start + size
+    void* new_start = (void*)((char*)block->start + size);
+    *new_block = (memory_block){new_start, block->block_size - size, true, block->next, block, NULL, NULL, NULL};
+
+    if(block->next != NULL)
+        ((memory_block*)block->next)->prev = new_block;
+    block->next = new_block;
+    block->block_size = size;
+
+    // Pages inside the rest were inside the whole block as well
+    new_block->zeroed = block->zeroed;
+    return new_block;
+}
+
+// Splits 'block' after its first 'size' bytes, the rest becomes a new free block.
+// Returns false, leaving the block whole, if there is no descriptor for the rest
+static bool split_block(mem_arena* arena, memory_block* block, size_t size){
+    memory_block* new_block = split_off_block(arena, block, size);
+    if(new_block == NULL)
+        return false;
+
+    free_list_insert(arena, new_block);
+    return true;
+}
+
+// Merges the block following 'block' into it. The follower must already be
+// out of the free lists and the lookup table
+static void absorb_next_block(mem_arena* arena, memory_block* block){
+    memory_block* next_block = block->next;
+
+    block->next = next_block->next;
+    if(next_block->next != NULL)
+        ((memory_block*)next_block->next)->prev = block;
+    block->block_size += next_block->block_size;
+    block->zeroed = false;
+
+    // The rover must not be left on a descriptor that is about to be recycled
+    if(arena->next_fit_rover == next_block)
+        arena->next_fit_rover = block;
+
+    arena->block_count--;
+    descriptor_free(arena, next_block);
+}
+
+// Bytes needed in front of 'block' for it to start at a multiple of 'alignment'
+static size_t alignment_padding(memory_block* block, size_t alignment){
+    return (alignment - ((size_t)block->start & (alignment - 1))) & (alignment - 1);
+}
+
+// Finds a free block that can hold 'size' bytes at a multiple of 'alignment', or NULL if there is none
+static memory_block* find_aligned_block(mem_arena* arena, size_t size, size_t alignment){
+    if(alignment <= 1)
+        return find_free_block(arena, size);
+
+    // A block with room for the worst case padding fits no matter where it starts
+    if(size <= (size_t)-1 - alignment){
+        memory_block* block = find_free_block(arena, size + alignment - 1);
+        if(block != NULL)
+            return block;
+    }
+
+    // Otherwise a tighter block may still do if it happens to start close to an aligned address.
+    // No free block has room for the padded size, so only the classes between the two are searched
+    int last_class = size <= (size_t)-1 - alignment ? size_class(size + alignment - 2) : SIZE_CLASS_COUNT - 1;
+    for(int class = size_class(size); class <= last_class; class++){
+        for(memory_block* walker = arena->free_lists[class]; walker != NULL; walker = walker->next_free){
+            if(walker->block_size >= size && walker->block_size - size >= alignment_padding(walker, alignment))
+                return walker;
+        }
+    }
+    return NULL;
+}
+
+// Whether a free block can still hold 'size' bytes at a multiple of 'alignment'
+static bool block_fits(memory_block* block, size_t size, size_t alignment){
+    if(!block->free || block->block_size < size)
+        return false;
+    return alignment <= 1 || block->block_size - size >= alignment_padding(block, alignment);
+}
+
+// Takes a free block that fits out of the shared pool, so it holds 'size' bytes at a multiple of
+// 'alignment'. Returns NULL, leaving the block free, if there is no descriptor for the padding
+static memory_block* take_block(mem_arena* arena, memory_block* block, size_t size, size_t alignment){
+    free_list_remove(arena, block);
+
+    // Split the padding off the front, it stays behind as a free block of its own
+    size_t padding = alignment > 1 ? alignment_padding(block, alignment) : 0;
+    if(padding > 0){
+        if(!split_block(arena, block, padding)){
+            free_list_insert(arena, block);
+            return NULL;
+        }
+
+        memory_block* padding_block = block;
+        block = block->next;
+        free_list_remove(arena, block);
+        free_list_insert(arena, padding_block);
+    }
+
+    // If the chosen memory block is larger than needed, fill out the rest
+    // of the space it previously occupied with a new empty memory block.
+    // Without a descriptor for the rest the whole block is handed out instead
+    if(block->block_size > size)
+        split_block(arena, block, size);
+
+    // Mark the memory block as allocated
+    block->free = false;
+    block_table_insert(arena, block);
+
+    // The next next-fit search continues right behind this block
+    arena->next_fit_rover = block->next;
+
+    return block;
+}
+
+// Takes a block starting at a multiple of 'alignment' out of the shared pool,
+// or returns NULL if no free block is large enough
+static memory_block* allocate_block(mem_arena* arena, size_t size, size_t alignment){
+    memory_block* block = find_aligned_block(arena, size, alignment);
+    if(block == NULL)
+        return NULL;
+    return take_block(arena, block, size, alignment);
+}
+
+// Carves up to 'count' blocks of 'size' bytes one after another off the front of a free block that
+// is out of the free lists, storing their starts in 'out'. What is left goes back in the free lists.
+// Returns the number of blocks carved, fewer than 'count' if the block runs out
+static size_t carve_blocks(mem_arena* arena, memory_block* block, size_t size, size_t count, void** out){
+    size_t carved = 0;
+    while(carved < count){
+        // Without a descriptor for the rest the whole block is handed out, as by take_block
+        memory_block* rest = block->block_size > size ? split_off_block(arena, block, size) : NULL;
+
+        block->free = false;
+        block_table_insert(arena, block);
+        out[carved++] = block->start;
+        arena->next_fit_rover = block->next;
+
+        if(rest == NULL)
+            return carved;
+        block = rest;
+        if(block->block_size < size)
+            break;
+    }
+
+    free_list_insert(arena, block);
+    return carved;
+}
+
+// Maps a pool of at least 'size' bytes, with huge pages if asked for. Returns NULL if that fails
+static void* pool_map(mem_arena* arena, size_t size){
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    if(arena->options.flags & MEM_HUGE_PAGES){
+#ifdef MAP_HUGETLB
+        // Reserved huge pages are used if there are any, MAP_HUGETLB fails otherwise
+        size_t length = (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+        void* pool = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(pool != MAP_FAILED){
+            arena->mapped_size = length;
+            arena->release_page_size = HUGE_PAGE_SIZE;
+            return pool;
+        }
+#endif
+        // Transparent huge pages are split up by releasing parts of them, so release whole ones only
+        page_size = HUGE_PAGE_SIZE;
+    }
+
+    size_t length = (size + page_size - 1) & ~(page_size - 1);
+    void* pool = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(pool == MAP_FAILED)
+        return NULL;
+
+#ifdef MADV_HUGEPAGE
+    if(arena->options.flags & MEM_HUGE_PAGES)
+        madvise(pool, length, MADV_HUGEPAGE);
+#endif
+
+    arena->mapped_size = length;
+    arena->release_page_size = page_size;
+    return pool;
+}
+
+// Hands the whole pages inside a large free block of a mapped pool back to the OS.
+// They are committed again, zero filled, when the block is next written to
+static void release_pages(mem_arena* arena, memory_block* block){
+    if(arena->mapped_size == 0 || block->block_size < arena->options.release_threshold)
+        return;
+
+    size_t first_page = ((size_t)block->start + arena->release_page_size - 1) & ~(arena->release_page_size - 1);
+    size_t end_page = ((size_t)block->start + block->block_size) & ~(arena->release_page_size - 1);
+    if(end_page > first_page){
+        madvise((void*)first_page, end_page - first_page, MADV_DONTNEED);
+        block->zeroed = true;
+    }
+}
+
+// Marks a block that is out of the lookup table free, merges it with its free neighbours
+// and puts the result in the free lists
+static void merge_free_block(mem_arena* arena, memory_block* block){
+    block->free = true;
+    block->zeroed = false;
+
+    // Merge with previous block
+    memory_block* block_preceding = block->prev;
+    if(block_preceding != NULL && block_preceding->free){
+        free_list_remove(arena, block_preceding);
+        absorb_next_block(arena, block_preceding);
+        block = block_preceding;
+    }
+
+    // Merge with next block
+    memory_block* next_block = block->next;
+    if(next_block != NULL && next_block->free){
+        free_list_remove(arena, next_block);
+        absorb_next_block(arena, block);
+    }
+
+    free_list_insert(arena, block);
+    release_pages(arena, block);
+}
+
+// Returns an allocated block to the shared pool and merges it with its free neighbours
+static void release_block(mem_arena* arena, memory_block* block){
+    block_table_remove(arena, block);
+    merge_free_block(arena, block);
+}
+
+// Hands the bytes of an allocated block past its first 'size' back to the pool,
+// merged with the block following it if that one is free
+static void trim_block(mem_arena* arena, memory_block* block, size_t size){
+    // Without a descriptor for the rest the block simply stays larger than asked for
+    if(block->block_size <= size || !split_block(arena, block, size))
+        return;
+
+    memory_block* rest = block->next;
+    rest->zeroed = false;
+    memory_block* next_block = rest->next;
+    if(next_block != NULL && next_block->free){
+        free_list_remove(arena, rest);
+        free_list_remove(arena, next_block);
+        absorb_next_block(arena, rest);
+        free_list_insert(arena, rest);
+    }
+    release_pages(arena, rest);
+}
+
+// Resizes an allocated block using only its free neighbours, moving the data back into the
+// block in front if that is needed. Returns the block now holding the data, or NULL if
+// the neighbours don't have enough room
+static memory_block* resize_in_place(mem_arena* arena, memory_block* block, size_t size){
+    memory_block* next_block = block->next;
+    size_t next_free_size = next_block != NULL && next_block->free ? next_block->block_size : 0;
+
+    // Shrinking, or growing into the free block behind it
+    if(block->block_size + next_free_size >= size){
+        if(block->block_size < size){
+            free_list_remove(arena, next_block);
+            absorb_next_block(arena, block);
+        }
+        trim_block(arena, block, size);
+        return block;
+    }
+
+    // Growing into the free block in front of it, and the one behind it if that isn't enough
+    memory_block* block_preceding = block->prev;
+    if(block_preceding == NULL || !block_preceding->free || block_preceding->block_size + block->block_size + next_free_size < size)
+        return NULL;
+
+    void* old_start = block->start;
+    size_t old_size = block->block_size;
+
+    block_table_remove(arena, block);
+    free_list_remove(arena, block_preceding);
+    absorb_next_block(arena, block_preceding);
+    if(block_preceding->block_size < size){
+        free_list_remove(arena, next_block);
+        absorb_next_block(arena, block_preceding);
+    }
+    block_preceding->free = false;
+    block_table_insert(arena, block_preceding);
+
+    // The old and new place of the data overlap
+    memmove(block_preceding->start, old_start, old_size);
+
+    trim_block(arena, block_preceding, size);
+    return block_preceding;
+}
+
+// Returns the slot of the lent out block starting at 'start', or -1 if the cache didn't lend it
+static int lent_find(thread_cache* cache, void* start){
+    size_t index = block_table_index(start, THREAD_CACHE_LENT_SIZE);
+    while(cache->lent[index] != NULL){
+        if(cache->lent[index]->start == start)
+            return (int)index;
+        index = (index + 1) & (THREAD_CACHE_LENT_SIZE - 1);
+    }
+    return -1;
+}
+
+static void lent_insert(thread_cache* cache, memory_block* block){
+    size_t index = block_table_index(block->start, THREAD_CACHE_LENT_SIZE);
+    while(cache->lent[index] != NULL){
+        index = (index + 1) & (THREAD_CACHE_LENT_SIZE - 1);
+    }
+    cache->lent[index] = block;
+    cache->lent_count++;
+}
+
+// Empties a slot and shifts later entries of the same probe run back into it
+static void lent_remove_at(thread_cache* cache, int slot){
+    size_t hole = (size_t)slot;
+    size_t index = hole;
+    cache->lent[hole] = NULL;
+    cache->lent_count--;
+
+    while(true){
+        index = (index + 1) & (THREAD_CACHE_LENT_SIZE - 1);
+        memory_block* block = cache->lent[index];
+        if(block == NULL)
+            return;
+
+        // Move the entry back if the hole lies between its home bucket and where it is now
+        size_t home = block_table_index(block->start, THREAD_CACHE_LENT_SIZE);
+        if(((index - home) & (THREAD_CACHE_LENT_SIZE - 1)) >= ((index - hole) & (THREAD_CACHE_LENT_SIZE - 1))){
+            cache->lent[hole] = block;
+            cache->lent[index] = NULL;
+            hole = index;
+        }
+    }
+}
+
+// Hands the oldest 'count' blocks of a bin back to the shared pool. Needs both locks
+static void thread_cache_flush_bin(mem_arena* arena, thread_cache* cache, int class, int count){
+    if(count > cache->bin_count[class])
+        count = cache->bin_count[class];
+
+    for(int i = 0; i < count; i++){
+        memory_block* block = cache->bins[class][i];
+        block->cache = NULL;
+        release_block(arena, block);
+    }
+
+    cache->bin_count[class] -= count;
+    memmove(cache->bins[class], cache->bins[class] + count, cache->bin_count[class] * sizeof(memory_block*));
+}
+
+// Hands every cached block of every thread back to the shared pool. Needs the pool lock
+static void thread_caches_drain(mem_arena* arena){
+    for(thread_cache* cache = arena->thread_caches; cache != NULL; cache = cache->next_cache){
+        pthread_mutex_lock(&cache->lock);
+        for(int class = 0; class < SIZE_CLASS_COUNT; class++){
+            thread_cache_flush_bin(arena, cache, class, cache->bin_count[class]);
+        }
+        pthread_mutex_unlock(&cache->lock);
+    }
+}
+
+// Takes a block out of whatever thread cache lent it, so the shared pool owns it again.
+// Returns false if the block sits unused in a bin, i.e. it is being freed twice. Needs the pool lock
+static bool thread_cache_disown(memory_block* block){
+    thread_cache* owner = block->cache;
+    if(owner == NULL)
+        return true;
+
+    pthread_mutex_lock(&owner->lock);
+    int slot = lent_find(owner, block->start);
+    if(slot >= 0){
+        lent_remove_at(owner, slot);
+        block->cache = NULL;
+    }
+    pthread_mutex_unlock(&owner->lock);
+
+    return slot >= 0;
+}
+
+// Returns the calling thread's cache, creating and registering it if needed. Needs the pool lock
+static thread_cache* thread_cache_get(mem_arena* arena){
+    if(arena->options.flags & MEM_NO_THREAD_CACHE)
+        return NULL;
+
+    thread_cache* cache = pthread_getspecific(arena->thread_cache_key);
+    if(cache != NULL)
+        return cache;
+
+    cache = calloc(1, sizeof(thread_cache));
+    if(cache == NULL)
+        return NULL;
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->arena = arena;
+
+    cache->next_cache = arena->thread_caches;
+    if(arena->thread_caches != NULL)
+        arena->thread_caches->prev_cache = cache;
+    arena->thread_caches = cache;
+
+    pthread_setspecific(arena->thread_cache_key, cache);
+    return cache;
+}
+
+// Unregisters and frees a cache. Its lent out blocks simply become ordinary allocated blocks
+static void thread_cache_destroy(mem_arena* arena, thread_cache* cache){
+    pthread_mutex_lock(&cache->lock);
+    for(int class = 0; class < SIZE_CLASS_COUNT; class++){
+        thread_cache_flush_bin(arena, cache, class, cache->bin_count[class]);
+    }
+    for(int i = 0; i < THREAD_CACHE_LENT_SIZE; i++){
+        if(cache->lent[i] != NULL)
+            cache->lent[i]->cache = NULL;
+    }
+    count_op(&arena->allocs, __atomic_load_n(&cache->allocs, __ATOMIC_RELAXED));
+    count_op(&arena->frees, __atomic_load_n(&cache->frees, __ATOMIC_RELAXED));
+    pthread_mutex_unlock(&cache->lock);
+
+    if(cache->prev_cache != NULL)
+        cache->prev_cache->next_cache = cache->next_cache;
+    else
+        arena->thread_caches = cache->next_cache;
+    if(cache->next_cache != NULL)
+        cache->next_cache->prev_cache = cache->prev_cache;
+
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+// Runs when a thread with a cache exits
+static void thread_cache_exit(void* cache){
+    mem_arena* arena = ((thread_cache*)cache)->arena;
+    pthread_rwlock_wrlock(&arena->lock);
+    thread_cache_destroy(arena, cache);
+    pthread_rwlock_unlock(&arena->lock);
+}
+
+// Hands out a cached block of exactly 'size' bytes without touching the pool lock, or returns NULL
+static void* thread_cache_alloc(mem_arena* arena, size_t size){
+    if(arena->options.flags & MEM_NO_THREAD_CACHE)
+        return NULL;
+
+    thread_cache* cache = pthread_getspecific(arena->thread_cache_key);
+    if(cache == NULL)
+        return NULL;
+
+    int class = size_class(size);
+    void* start = NULL;
+
+    pthread_mutex_lock(&cache->lock);
+    // Only exact fits are reused, so caching never wastes pool space on oversized blocks
+    for(int i = cache->bin_count[class] - 1; i >= 0 && cache->lent_count < THREAD_CACHE_LENT_SIZE / 2; i--){
+        memory_block* block = cache->bins[class][i];
+        if(block->block_size == size){
+            cache->bin_count[class]--;
+            cache->bins[class][i] = cache->bins[class][cache->bin_count[class]];
+            lent_insert(cache, block);
+            __atomic_add_fetch(&cache->allocs, 1, __ATOMIC_RELAXED);
+            start = block->start;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    return start;
+}
+
+// Takes back a block this thread's cache handed out, without touching the pool lock.
+// Returns false if the block has to be freed through the shared pool instead
+static bool thread_cache_free(mem_arena* arena, void* start){
+    if(arena->options.flags & MEM_NO_THREAD_CACHE)
+        return false;
+
+    thread_cache* cache = pthread_getspecific(arena->thread_cache_key);
+    if(cache == NULL)
+        return false;
+
+    bool cached = false;
+
+    pthread_mutex_lock(&cache->lock);
+    int slot = lent_find(cache, start);
+    if(slot >= 0){
+        memory_block* block = cache->lent[slot];
+        int class = size_class(block->block_size);
+
+        // A full bin needs the pool lock to be flushed, so leave that to the slow path
+        if(cache->bin_count[class] < THREAD_CACHE_SLOTS){
+            lent_remove_at(cache, slot);
+            cache->bins[class][cache->bin_count[class]++] = block;
+            __atomic_add_fetch(&cache->frees, 1, __ATOMIC_RELAXED);
+            cached = true;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    return cached;
+}
+
+static unsigned long long now_ns(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
+
+// Histogram buckets are log-linear: values below MEM_HISTOGRAM_SUB_BUCKETS get a bucket each, every
+// power of two above that is split into MEM_HISTOGRAM_SUB_BUCKETS equally wide buckets
+static int histogram_bucket(unsigned long long value){
+    if(value < MEM_HISTOGRAM_SUB_BUCKETS)
+        return (int)value;
+
+    // Values past the last bucket are counted in it
+    int shift = 63 - __builtin_clzll(value) - __builtin_ctz(MEM_HISTOGRAM_SUB_BUCKETS);
+    int bucket = (shift + 1) * MEM_HISTOGRAM_SUB_BUCKETS + (int)(value >> shift) - MEM_HISTOGRAM_SUB_BUCKETS;
+    return bucket < MEM_HISTOGRAM_BUCKETS ? bucket : MEM_HISTOGRAM_BUCKETS - 1;
+}
+
+// The largest value counted in a bucket
+static unsigned long long histogram_bucket_limit(int bucket){
+    if(bucket < MEM_HISTOGRAM_SUB_BUCKETS)
+        return (unsigned long long)bucket;
+
+    int shift = bucket / MEM_HISTOGRAM_SUB_BUCKETS - 1;
+    unsigned long long first = (unsigned long long)(bucket % MEM_HISTOGRAM_SUB_BUCKETS + MEM_HISTOGRAM_SUB_BUCKETS) << shift;
+    return first + (1ULL << shift) - 1;
+}
+
+// Only the owning thread records, so 'max' needs no compare and swap
+static void histogram_record(mem_histogram* histogram, unsigned long long value){
+    __atomic_fetch_add(&histogram->counts[histogram_bucket(value)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->sum, value, __ATOMIC_RELAXED);
+    if(value > __atomic_load_n(&histogram->max, __ATOMIC_RELAXED))
+        __atomic_store_n(&histogram->max, value, __ATOMIC_RELAXED);
+}
+
+// Adds the counts of a latency record that may still be recorded to, to another one
+static void latency_add(mem_latency* to, mem_latency* from){
+    for(int op = 0; op < MEM_OP_COUNT; op++){
+        for(int phase = 0; phase < MEM_PHASE_COUNT; phase++){
+            mem_histogram* to_histogram = &to->histograms[op][phase];
+            mem_histogram* from_histogram = &from->histograms[op][phase];
+
+            for(int i = 0; i < MEM_HISTOGRAM_BUCKETS; i++){
+                to_histogram->counts[i] += __atomic_load_n(&from_histogram->counts[i], __ATOMIC_RELAXED);
+            }
+            to_histogram->count += __atomic_load_n(&from_histogram->count, __ATOMIC_RELAXED);
+            to_histogram->sum += __atomic_load_n(&from_histogram->sum, __ATOMIC_RELAXED);
+
+            unsigned long long max = __atomic_load_n(&from_histogram->max, __ATOMIC_RELAXED);
+            if(max > to_histogram->max)
+                to_histogram->max = max;
+        }
+    }
+}
+
+static void latency_clear(mem_latency* latency){
+    for(int op = 0; op < MEM_OP_COUNT; op++){
+        for(int phase = 0; phase < MEM_PHASE_COUNT; phase++){
+            mem_histogram* histogram = &latency->histograms[op][phase];
+
+            for(int i = 0; i < MEM_HISTOGRAM_BUCKETS; i++){
+                __atomic_store_n(&histogram->counts[i], 0, __ATOMIC_RELAXED);
+            }
+            __atomic_store_n(&histogram->count, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&histogram->sum, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&histogram->max, 0, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Returns the calling thread's latency recorder, creating and registering it if needed
+static latency_recorder* latency_recorder_get(mem_arena* arena){
+    latency_recorder* recorder = pthread_getspecific(arena->latency_key);
+    if(recorder != NULL)
+        return recorder;
+
+    recorder = calloc(1, sizeof(latency_recorder));
+    if(recorder == NULL)
+        return NULL;
+    recorder->arena = arena;
+
+    pthread_mutex_lock(&arena->latency_lock);
+    recorder->next_recorder = arena->latency_recorders;
+    if(arena->latency_recorders != NULL)
+        arena->latency_recorders->prev_recorder = recorder;
+    arena->latency_recorders = recorder;
+    pthread_mutex_unlock(&arena->latency_lock);
+
+    pthread_setspecific(arena->latency_key, recorder);
+    return recorder;
+}
+
+// Unregisters and frees a recorder, keeping what it recorded. Needs the latency lock
+static void latency_recorder_destroy(mem_arena* arena, latency_recorder* recorder){
+    latency_add(arena->retired_latency, &recorder->latency);
+
+    if(recorder->prev_recorder != NULL)
+        recorder->prev_recorder->next_recorder = recorder->next_recorder;
+    else
+        arena->latency_recorders = recorder->next_recorder;
+    if(recorder->next_recorder != NULL)
+        recorder->next_recorder->prev_recorder = recorder->prev_recorder;
+
+    free(recorder);
+}
+
+// Runs when a thread with a latency recorder exits
+static void latency_recorder_exit(void* recorder){
+    mem_arena* arena = ((latency_recorder*)recorder)->arena;
+    pthread_mutex_lock(&arena->latency_lock);
+    latency_recorder_destroy(arena, recorder);
+    pthread_mutex_unlock(&arena->latency_lock);
+}
+
+static void op_timer_start(mem_arena* arena, op_timer* timer){
+    *timer = (op_timer){0};
+    if(arena->options.flags & MEM_INSTRUMENT){
+        timer->on = true;
+        timer->start = now_ns();
+    }
+}
+
+// Records the call's latency in the calling thread's histograms. Calls that never took
+// the pool lock, i.e. were served by the thread cache, only have their total recorded
+static void op_timer_stop(mem_arena* arena, op_timer* timer, mem_op op){
+    if(!timer->on)
+        return;
+
+    unsigned long long total = now_ns() - timer->start;
+    latency_recorder* recorder = latency_recorder_get(arena);
+    if(recorder == NULL)
+        return;
+
+    histogram_record(&recorder->latency.histograms[op][MEM_PHASE_TOTAL], total);
+    if(timer->used_lock){
+        histogram_record(&recorder->latency.histograms[op][MEM_PHASE_LOCK_WAIT], timer->lock_wait);
+        histogram_record(&recorder->latency.histograms[op][MEM_PHASE_SEARCH], timer->lock_held);
+    }
+}
+
+// Takes the pool lock exclusively, or shared if 'shared' is set, timing the wait for it if the call is being measured
+static void arena_lock_as(mem_arena* arena, op_timer* timer, bool shared){
+    unsigned long long before = timer->on ? now_ns() : 0;
+
+    if(shared)
+        pthread_rwlock_rdlock(&arena->lock);
+    else
+        pthread_rwlock_wrlock(&arena->lock);
+
+    if(timer->on){
+        timer->lock_taken = now_ns();
+        timer->lock_wait += timer->lock_taken - before;
+        timer->used_lock = true;
+    }
+}
+
+static void arena_lock(mem_arena* arena, op_timer* timer){
+    arena_lock_as(arena, timer, false);
+}
+
+static void arena_lock_shared(mem_arena* arena, op_timer* timer){
+    arena_lock_as(arena, timer, true);
+}
+
+static void arena_unlock(mem_arena* arena, op_timer* timer){
+    if(timer->on)
+        timer->lock_held += now_ns() - timer->lock_taken;
+    pthread_rwlock_unlock(&arena->lock);
+}
+
+static bool arena_setup(mem_arena* arena);
+
+// Splits the pool of an arena into equally sized shards, the last one taking what is left over
+static bool shards_init(mem_arena* arena){
+    unsigned int count = arena->options.shards;
+    size_t shard_size = (arena->size / count) & ~(arena->options.min_alignment - 1);
+
+    arena->shards = calloc(count, sizeof(mem_arena));
+    if(arena->shards == NULL)
+        return false;
+    arena->shard_count = count;
+
+    bool success = true;
+    for(unsigned int i = 0; i < count; i++){
+        mem_arena* shard = &arena->shards[i];
+
+        // The arena measures calls as a whole, including the time spent in its shards
+        shard->options = arena->options;
+        shard->options.shards = 0;
+        shard->options.flags &= ~MEM_INSTRUMENT;
+
+        shard->memory = (char*)arena->memory + i * shard_size;
+        shard->size = i + 1 < count ? shard_size : arena->size - i * shard_size;
+        shard->owns_memory = false;
+        shard->mapped_size = arena->mapped_size;
+        shard->release_page_size = arena->release_page_size;
+        shard->parent = arena;
+
+        success = arena_setup(shard) && success;
+    }
+    return success;
+}
+
+// Sets up the bookkeeping of an arena whose options and pool are already in place. Returns false
+// if some of it couldn't be allocated, in which case the arena still has to be torn down with arena_deinit
+static bool arena_setup(mem_arena* arena){
+    bool success = true;
+
+    pthread_rwlock_init(&arena->lock, NULL);
+
+    arena->descriptor_chunks = NULL;
+    arena->free_descriptors = NULL;
+    arena->descriptor_chunk_size = DESCRIPTOR_CHUNK_INITIAL_SIZE;
+    arena->memory_block_head = NULL;
+    arena->block_count = 0;
+    arena->next_fit_rover = NULL;
+    arena->free_tree_root = NULL;
+
+    memset(arena->free_lists, 0, sizeof(arena->free_lists));
+    arena->free_list_map = 0;
+    memset(arena->free_list_largest, 0, sizeof(arena->free_list_largest));
+    memset(arena->free_list_largest_count, 0, sizeof(arena->free_list_largest_count));
+    arena->free_bytes = 0;
+    arena->free_block_count = 0;
+    arena->allocs = 0;
+    arena->frees = 0;
+    arena->resizes = 0;
+    arena->alloc_failures = 0;
+    arena->free_failures = 0;
+    arena->resize_failures = 0;
+
+    arena->block_table = NULL;
+    arena->block_table_size = 0;
+    arena->block_table_count = 0;
+    arena->thread_caches = NULL;
+    arena->shards = NULL;
+    arena->shard_count = 0;
+
+    if(arena->options.shards > 1){
+        success = shards_init(arena);
+
+        // All blocks live in the shards, so there is nothing for the arena itself to cache
+        arena->options.flags |= MEM_NO_THREAD_CACHE;
+    }
+    else{
+        arena->memory_block_head = descriptor_alloc(arena);
+        if(arena->memory_block_head != NULL){
+            *arena->memory_block_head = (memory_block) {arena->memory, arena->size, true, NULL, NULL, NULL, NULL, NULL};
+            arena->block_count = 1;
+
+            // Freshly mapped pages read as zero
+            arena->memory_block_head->zeroed = arena->mapped_size > 0;
+            if(arena->size > 0)
+                free_list_insert(arena, arena->memory_block_head);
+        }
+
+        arena->block_table = calloc(BLOCK_TABLE_INITIAL_SIZE, sizeof(memory_block*));
+        arena->block_table_size = BLOCK_TABLE_INITIAL_SIZE;
+
+        success = arena->memory_block_head != NULL && arena->block_table != NULL;
+    }
+
+    // Without a key of its own the arena simply runs without thread caches
+    if(!(arena->options.flags & MEM_NO_THREAD_CACHE) && pthread_key_create(&arena->thread_cache_key, thread_cache_exit) != 0)
+        arena->options.flags |= MEM_NO_THREAD_CACHE;
+
+    arena->error_callback = NULL;
+    arena->error_callback_data = NULL;
+
+    arena->handles = NULL;
+    arena->handle_capacity = 0;
+    arena->free_handle = 0;
+    pthread_mutex_init(&arena->compactor_lock, NULL);
+    pthread_cond_init(&arena->compactor_wake, NULL);
+    arena->compactor_running = false;
+
+    // Likewise, an arena that can't get a key or the memory to keep latencies in goes uninstrumented
+    pthread_mutex_init(&arena->latency_lock, NULL);
+    arena->latency_recorders = NULL;
+    arena->retired_latency = NULL;
+    if(arena->options.flags & MEM_INSTRUMENT){
+        arena->retired_latency = calloc(1, sizeof(mem_latency));
+        if(arena->retired_latency == NULL || pthread_key_create(&arena->latency_key, latency_recorder_exit) != 0){
+            free(arena->retired_latency);
+            arena->retired_latency = NULL;
+            arena->options.flags &= ~MEM_INSTRUMENT;
+        }
+    }
+
+    return success;
+}
+
+// Sets up an arena with a pool of 'size' bytes. Returns false if the pool or its bookkeeping
+// couldn't be allocated, in which case the arena still has to be torn down with arena_deinit
+static bool arena_init(mem_arena* arena, size_t size, const mem_options* init_options){
+    if(init_options != NULL)
+        arena->options = *init_options;
+    else
+        arena->options = (mem_options){0};
+
+    // The minimum alignment has to be a power of two, round it up to one
+    size_t min_alignment = 1;
+    while(min_alignment < arena->options.min_alignment){
+        min_alignment *= 2;
+    }
+    arena->options.min_alignment = min_alignment;
+
+    if(arena->options.flags & MEM_HUGE_PAGES)
+        arena->options.flags |= MEM_MMAP;
+    if(arena->options.release_threshold == 0)
+        arena->options.release_threshold = DEFAULT_RELEASE_THRESHOLD;
+
+    // Every shard needs room for at least one block
+    if(arena->options.shards > MEM_MAX_SHARDS)
+        arena->options.shards = MEM_MAX_SHARDS;
+    if(arena->options.shards <= 1 || ((size / arena->options.shards) & ~(min_alignment - 1)) == 0)
+        arena->options.shards = 0;
+
+    arena->mapped_size = 0;
+    arena->release_page_size = 0;
+
+    // malloc only guarantees the alignment of the largest basic type
+    if(arena->options.flags & MEM_MMAP){
+        arena->memory = pool_map(arena, size);
+    }
+    else if(arena->options.min_alignment > _Alignof(max_align_t)){
+        if(posix_memalign(&arena->memory, arena->options.min_alignment, size) != 0)
+            arena->memory = NULL;
+    }
+    else{
+        arena->memory = malloc(size);
+    }
+    arena->size = size;
+    arena->owns_memory = true;
+    arena->parent = NULL;
+
+    bool success = arena_setup(arena);
+    return (arena->memory != NULL || size == 0) && success;
+}
+
+// Frees everything an arena allocated
+static void arena_deinit(mem_arena* arena){
+    // The compactor works on the pool, so it has to be gone before anything is torn down
+    mem_arena_compactor_stop(arena);
+    pthread_mutex_destroy(&arena->compactor_lock);
+    pthread_cond_destroy(&arena->compactor_wake);
+    free(arena->handles);
+    arena->handles = NULL;
+    arena->handle_capacity = 0;
+    arena->free_handle = 0;
+
+    for(unsigned int i = 0; i < arena->shard_count; i++){
+        arena_deinit(&arena->shards[i]);
+    }
+    free(arena->shards);
+    arena->shards = NULL;
+    arena->shard_count = 0;
+
+    while(arena->thread_caches != NULL){
+        thread_cache_destroy(arena, arena->thread_caches);
+    }
+    if(!(arena->options.flags & MEM_NO_THREAD_CACHE))
+        pthread_key_delete(arena->thread_cache_key);
+
+    if(arena->options.flags & MEM_INSTRUMENT){
+        while(arena->latency_recorders != NULL){
+            latency_recorder_destroy(arena, arena->latency_recorders);
+        }
+        pthread_key_delete(arena->latency_key);
+        free(arena->retired_latency);
+        arena->retired_latency = NULL;
+    }
+    pthread_mutex_destroy(&arena->latency_lock);
+
+    if(arena->owns_memory && arena->mapped_size > 0)
+        munmap(arena->memory, arena->mapped_size);
+    else if(arena->owns_memory)
+        free(arena->memory);
+    arena->memory = NULL;
+    arena->mapped_size = 0;
+
+    // Block descriptors all live in the chunks, so freeing those frees every descriptor
+    descriptor_chunk* walker_of_death = arena->descriptor_chunks;
+    while(walker_of_death != NULL) {
+        descriptor_chunk* to_del = walker_of_death;
+        walker_of_death = walker_of_death->next_chunk;
+        free(to_del);
+    }
+    arena->descriptor_chunks = NULL;
+    arena->free_descriptors = NULL;
+    arena->memory_block_head = NULL;
+    arena->next_fit_rover = NULL;
+    arena->free_tree_root = NULL;
+
+    memset(arena->free_lists, 0, sizeof(arena->free_lists));
+    arena->free_list_map = 0;
+    memset(arena->free_list_largest, 0, sizeof(arena->free_list_largest));
+    memset(arena->free_list_largest_count, 0, sizeof(arena->free_list_largest_count));
+
+    free(arena->block_table);
+    arena->block_table = NULL;
+    arena->block_table_size = 0;
+    arena->block_table_count = 0;
+
+    pthread_rwlock_destroy(&arena->lock);
+}
+
+// Rounds 'size' up to a multiple of the minimum alignment, returns 0 if that overflows
+static size_t round_to_min_alignment(mem_arena* arena, size_t size){
+    if(size > (size_t)-1 - (arena->options.min_alignment - 1))
+        return 0;
+    return (size + arena->options.min_alignment - 1) & ~(arena->options.min_alignment - 1);
+}
+
+// Clears the first 'size' bytes of a block just taken from the pool, skipping the whole
+// pages in it that are known to read as zero if the block was 'zeroed' when it was taken
+static void clear_block(mem_arena* arena, void* start, size_t size, bool zeroed){
+    size_t first_page = ((size_t)start + arena->release_page_size - 1) & ~(arena->release_page_size - 1);
+    size_t end_page = ((size_t)start + size) & ~(arena->release_page_size - 1);
+    if(!zeroed || end_page <= first_page){
+        memset(start, 0, size);
+        return;
+    }
+
+    memset(start, 0, first_page - (size_t)start);
+    memset((void*)end_page, 0, (size_t)start + size - end_page);
+}
+
+// Allocates from the shared pool, draining the thread caches if the pool is out of space.
+// With 'zero' set the block is cleared before it is returned
+static void* pool_alloc(mem_arena* arena, size_t size, size_t alignment, bool zero, op_timer* timer){
+    memory_block* walker;
+
+    // First and next fit walk the block list, which can take long. The walk only reads, so it runs
+    // under the shared lock, letting searches of several threads overlap, and only taking the block
+    // found needs the lock exclusively. If another thread got to the block in between, search again
+    if(arena->options.policy == MEM_POLICY_FIRST_FIT || arena->options.policy == MEM_POLICY_NEXT_FIT){
+        arena_lock_shared(arena, timer);
+        memory_block* candidate = find_aligned_block(arena, size, alignment);
+        arena_unlock(arena, timer);
+
+        arena_lock(arena, timer);
+        if(candidate == NULL)
+            walker = NULL;
+        else if(block_fits(candidate, size, alignment))
+            walker = take_block(arena, candidate, size, alignment);
+        else
+            walker = allocate_block(arena, size, alignment);
+    }
+    else{
+        arena_lock(arena, timer);
+        walker = allocate_block(arena, size, alignment);
+    }
+
+    // Blocks idling in thread caches may be what is missing, so return them and try again
+    if(walker == NULL && arena->thread_caches != NULL){
+        thread_caches_drain(arena);
+        walker = allocate_block(arena, size, alignment);
+    }
+
+    //If it rejected all existing memory blocks, allocation is impossible
+    if(walker == NULL){
+        arena_unlock(arena, timer);
+        report_error(arena, MEM_OP_ALLOC, MEM_ERROR_NO_SPACE, NULL, size);
+        return NULL;
+    }
+
+    count_op(&arena->allocs, 1);
+    DEBUG(printf("at %lu ", (size_t)walker->start));
+    void* start = walker->start;
+    bool zeroed = walker->zeroed;
+    arena_unlock(arena, timer);
+
+    // The block is ours now, so it is cleared without holding up the others
+    if(zero)
+        clear_block(arena, start, size, zeroed);
+    return start;
+}
+
+static void* arena_alloc(mem_arena* arena, size_t size, op_timer* timer){
+    DEBUG(printf("mem_alloc: %lu ", size));
+
+    // Zero sized allocations still get a byte of their own, so every
+    // allocation has a unique start address to be freed by
+    if(size == 0)
+        size = 1;
+
+    size_t rounded_size = round_to_min_alignment(arena, size);
+    if(rounded_size == 0){
+        report_error(arena, MEM_OP_ALLOC, MEM_ERROR_NO_SPACE, NULL, size);
+        return NULL;
+    }
+    size = rounded_size;
+
+    // Recently freed blocks of this thread are reused without the pool lock
+    void* cached = thread_cache_alloc(arena, size);
+    if(cached != NULL)
+        return cached;
+
+    return pool_alloc(arena, size, arena->options.min_alignment, false, timer);
+}
+
+static void* arena_calloc(mem_arena* arena, size_t size, op_timer* timer){
+    DEBUG(printf("mem_calloc: %lu ", size));
+
+    if(size == 0)
+        size = 1;
+
+    size_t rounded_size = round_to_min_alignment(arena, size);
+    if(rounded_size == 0){
+        report_error(arena, MEM_OP_ALLOC, MEM_ERROR_NO_SPACE, NULL, size);
+        return NULL;
+    }
+
+    // Cached blocks have been used before, so they are cleared in full
+    void* cached = thread_cache_alloc(arena, rounded_size);
+    if(cached != NULL){
+        memset(cached, 0, size);
+        return cached;
+    }
+
+    return pool_alloc(arena, rounded_size, arena->options.min_alignment, true, timer);
+}
+
+static void* arena_alloc_aligned(mem_arena* arena, size_t size, size_t alignment, op_timer* timer){
+    DEBUG(printf("mem_alloc_aligned: %lu at %lu ", size, alignment));
+
+    if(alignment == 0 || (alignment & (alignment - 1)) != 0){
+        report_error(arena, MEM_OP_ALLOC, MEM_ERROR_INVALID_ARGUMENT, NULL, size);
+        return NULL;
+    }
+
+    if(size == 0)
+        size = 1;
+
+    size_t rounded_size = round_to_min_alignment(arena, size);
+    if(rounded_size == 0){
+        report_error(arena, MEM_OP_ALLOC, MEM_ERROR_NO_SPACE, NULL, size);
+        return NULL;
+    }
+    size = rounded_size;
+
+    // Every block meets the minimum alignment, so cached blocks do for weaker requests
+    if(alignment <= arena->options.min_alignment){
+        void* cached = thread_cache_alloc(arena, size);
+        if(cached != NULL)
+            return cached;
+
+        alignment = arena->options.min_alignment;
+    }
+
+    return pool_alloc(arena, size, alignment, false, timer);
+}
+
+// Returns false if there is no such block to free
+static bool arena_free(mem_arena* arena, void* block, op_timer* timer){
+    DEBUG(printf("memfree: %lu ", (size_t)block));
+
+    // Check if block is uninitiliazed
+    if(block == NULL){
+        return true;
+    }
+
+    // Blocks handed out by this thread's cache go straight back to it
+    if(thread_cache_free(arena, block))
+        return true;
+
+    arena_lock(arena, timer);
+
+    // Only allocated blocks are in the lookup table, so this also
+    // rejects blocks that are already free. Handle blocks are freed through their handle
+    memory_block* block_to_free = block_table_find(arena, block);
+    if(block_to_free == NULL || block_to_free->handle != 0 || !thread_cache_disown(block_to_free)){
+        arena_unlock(arena, timer);
+        report_error(arena, MEM_OP_FREE, MEM_ERROR_INVALID_BLOCK, block, 0);
+        return false;
+    }
+    count_op(&arena->frees, 1);
+
+    // Keep the block in this thread's cache for its next allocation of the same size,
+    // handing the oldest half of the bin back to the pool if the bin is full
+    thread_cache* cache = thread_cache_get(arena);
+    if(cache != NULL){
+        int class = size_class(block_to_free->block_size);
+
+        pthread_mutex_lock(&cache->lock);
+        if(cache->bin_count[class] == THREAD_CACHE_SLOTS)
+            thread_cache_flush_bin(arena, cache, class, THREAD_CACHE_SLOTS / 2);
+        block_to_free->cache = cache;
+        cache->bins[class][cache->bin_count[class]++] = block_to_free;
+        pthread_mutex_unlock(&cache->lock);
+    }
+    else{
+        release_block(arena, block_to_free);
+    }
+
+    arena_unlock(arena, timer);
+
+    return true;
+}
+
+// Changes size of block, moving it only if its neighbours can't make room
+static void* arena_resize(mem_arena* arena, void* block, size_t size, op_timer* timer){
+    DEBUG(printf("mem_resize: %lu ", size));
+
+    // Keep resized blocks a multiple of the minimum alignment too
+    size_t rounded_size = round_to_min_alignment(arena, size == 0 ? 1 : size);
+    if(rounded_size == 0){
+        report_error(arena, MEM_OP_RESIZE, MEM_ERROR_NO_SPACE, block, size);
+        return NULL;
+    }
+    size = rounded_size;
+
+    arena_lock(arena, timer);
+
+    memory_block* block_to_resize = block_table_find(arena, block);
+
+    // If it can't find the block, just return
+    if(block_to_resize == NULL || block_to_resize->handle != 0 || !thread_cache_disown(block_to_resize)){
+        arena_unlock(arena, timer);
+        report_error(arena, MEM_OP_RESIZE, MEM_ERROR_INVALID_BLOCK, block, size);
+        return NULL;
+    }
+
+    memory_block* resized = resize_in_place(arena, block_to_resize, size);
+    memory_block* new_block = NULL;
+    if(resized == NULL)
+        new_block = allocate_block(arena, size, arena->options.min_alignment);
+
+    // Blocks idling in thread caches may be the free neighbours or the space that is missing
+    if(resized == NULL && new_block == NULL && arena->thread_caches != NULL){
+        thread_caches_drain(arena);
+        resized = resize_in_place(arena, block_to_resize, size);
+        if(resized == NULL)
+            new_block = allocate_block(arena, size, arena->options.min_alignment);
+    }
+
+    if(resized != NULL){
+        count_op(&arena->resizes, 1);
+        DEBUG(printf("Resized in place at %lu ", (size_t)resized->start));
+        arena_unlock(arena, timer);
+        return resized->start;
+    }
+
+    if(new_block == NULL){
+        arena_unlock(arena, timer);
+        report_error(arena, MEM_OP_RESIZE, MEM_ERROR_NO_SPACE, block, size);
+        return NULL;
+    }
+    count_op(&arena->resizes, 1);
+
+    size_t old_size = block_to_resize->block_size;
+    void* new_start = new_block->start;
+    arena_unlock(arena, timer);
+
+    // Both blocks belong to the caller until the old one is released, so copy without the lock
+    memcpy(new_start, block, old_size < size ? old_size : size);
+
+    DEBUG(printf("Old address: %lu, new address: %lu.", (size_t)block, (size_t)new_start));
+
+    arena_lock(arena, timer);
+    release_block(arena, block_to_resize);
+    arena_unlock(arena, timer);
+
+    return new_start;
+}
+
+// Allocates 'count' blocks of 'size' bytes under a single hold of the pool lock, carving as many of
+// them as fit out of each free block it takes. Returns how many it got, failures are left to the caller
+static size_t arena_alloc_batch(mem_arena* arena, size_t size, size_t count, void** out, op_timer* timer){
+    size_t allocated = 0;
+    bool drained = false;
+
+    arena_lock(arena, timer);
+    while(allocated < count){
+        // Preferably one block holds the whole rest of the batch, otherwise any block holding one will do
+        size_t remaining = count - allocated;
+        memory_block* block = NULL;
+        if(remaining <= (size_t)-1 / size)
+            block = find_free_block(arena, size * remaining);
+        if(block == NULL)
+            block = find_free_block(arena, size);
+
+        // Blocks idling in thread caches may be what is missing, so return them and try again
+        if(block == NULL && !drained && arena->thread_caches != NULL){
+            thread_caches_drain(arena);
+            drained = true;
+            continue;
+        }
+        if(block == NULL)
+            break;
+
+        free_list_remove(arena, block);
+        allocated += carve_blocks(arena, block, size, remaining, out + allocated);
+    }
+    count_op(&arena->allocs, allocated);
+    arena_unlock(arena, timer);
+
+    return allocated;
+}
+
+static int compare_addresses(const void* a, const void* b){
+    size_t first = (size_t)*(void* const*)a;
+    size_t second = (size_t)*(void* const*)b;
+    return (first > second) - (first < second);
+}
+
+// Frees the blocks of 'blocks', which must be sorted by address, under a single hold of the pool lock.
+// Runs of blocks that lie next to each other in the pool are merged before they go back in the free
+// lists, so each run costs one free list update. Returns the number of blocks that could not be freed,
+// with the first of them in 'invalid'
+static size_t arena_free_batch(mem_arena* arena, void** blocks, size_t count, void** invalid, op_timer* timer){
+    size_t failures = 0;
+    size_t freed = 0;
+
+    arena_lock(arena, timer);
+    for(size_t i = 0; i < count; i++){
+        if(blocks[i] == NULL)
+            continue;
+
+        // Batch frees go straight to the pool, taking blocks back from the caches that lent them
+        memory_block* run = block_table_find(arena, blocks[i]);
+        if(run == NULL || run->handle != 0 || !thread_cache_disown(run)){
+            if(failures++ == 0)
+                *invalid = blocks[i];
+            continue;
+        }
+        block_table_remove(arena, run);
+        freed++;
+
+        while(i + 1 < count){
+            memory_block* next_block = run->next;
+            if(next_block == NULL || next_block->start != blocks[i + 1] || next_block->free || next_block->handle != 0
+               || block_table_find(arena, next_block->start) != next_block || !thread_cache_disown(next_block))
+                break;
+
+            block_table_remove(arena, next_block);
+            absorb_next_block(arena, run);
+            freed++;
+            i++;
+        }
+
+        merge_free_block(arena, run);
+    }
+    count_op(&arena->frees, freed);
+    arena_unlock(arena, timer);
+
+    return failures;
+}
+
+// Initializes the memory manager, with a memory pool of size amount of bytes
+void mem_init(size_t size){
+    mem_init_ex(size, NULL);
+}
+
+// Initializes the memory manager like mem_init, but with the given placement policy and flags
+void mem_init_ex(size_t size, const mem_options* init_options){
+    DEBUG(printf("mem_init: %lu ", size));
+
+    arena_init(&default_arena, size, init_options);
+}
+
+mem_arena* mem_arena_create(size_t size, const mem_options* init_options){
+    DEBUG(printf("mem_arena_create: %lu ", size));
+
+    mem_arena* arena = malloc(sizeof(mem_arena));
+    if(arena == NULL){
+        last_error = MEM_ERROR_SYSTEM;
+        return NULL;
+    }
+
+    if(!arena_init(arena, size, init_options)){
+        arena_deinit(arena);
+        free(arena);
+        last_error = MEM_ERROR_SYSTEM;
+        return NULL;
+    }
+    return arena;
+}
+
+// The shard whose part of the pool holds 'block', or NULL if the block lies outside the pool
+static mem_arena* shard_of(mem_arena* arena, void* block){
+    if((char*)block < (char*)arena->memory || (size_t)((char*)block - (char*)arena->memory) >= arena->size)
+        return NULL;
+
+    // Every shard but the last is as large as the first, the last one also holds what is left over
+    size_t index = (size_t)((char*)block - (char*)arena->memory) / arena->shards[0].size;
+    return &arena->shards[index < arena->shard_count ? index : arena->shard_count - 1];
+}
+
+// Size of the allocated block at 'block', or 0 if there is none
+static size_t allocated_size(mem_arena* arena, void* block){
+    pthread_rwlock_rdlock(&arena->lock);
+    memory_block* found = block_table_find(arena, block);
+    size_t size = found != NULL ? found->block_size : 0;
+    pthread_rwlock_unlock(&arena->lock);
+    return size;
+}
+
+// Allocates from the calling thread's home shard, or if that one is full from the others in turn.
+// 'alignment' is 0 for plain allocations, with 'zero' set the block is cleared as by mem_calloc.
+// Failures are left to the caller to report
+static void* shards_alloc(mem_arena* arena, size_t size, size_t alignment, bool zero, op_timer* timer){
+    if(thread_number == 0)
+        thread_number = __atomic_add_fetch(&thread_count, 1, __ATOMIC_RELAXED);
+    unsigned int home = (thread_number - 1) % arena->shard_count;
+
+    for(unsigned int i = 0; i < arena->shard_count; i++){
+        mem_arena* shard = &arena->shards[(home + i) % arena->shard_count];
+        void* block = zero ? arena_calloc(shard, size, timer)
+                    : alignment == 0 ? arena_alloc(shard, size, timer) : arena_alloc_aligned(shard, size, alignment, timer);
+        if(block != NULL)
+            return block;
+
+        // Only running out of space is worth trying the next shard for
+        if(last_error != MEM_ERROR_NO_SPACE)
+            break;
+    }
+    return NULL;
+}
+
+static void* sharded_alloc(mem_arena* arena, size_t size, size_t alignment, bool zero, op_timer* timer){
+    void* block = shards_alloc(arena, size, alignment, zero, timer);
+    if(block == NULL)
+        report_error(arena, MEM_OP_ALLOC, last_error, NULL, size);
+    return block;
+}
+
+// Frees a block through the shard it lies in
+static void sharded_free(mem_arena* arena, void* block, op_timer* timer){
+    if(block == NULL)
+        return;
+
+    mem_arena* shard = shard_of(arena, block);
+    if(shard == NULL || !arena_free(shard, block, timer))
+        report_error(arena, MEM_OP_FREE, MEM_ERROR_INVALID_BLOCK, block, 0);
+}
+
+// Resizes a block within its shard, or moves it to another shard if its own is full
+static void* sharded_resize(mem_arena* arena, void* block, size_t size, op_timer* timer){
+    mem_arena* shard = shard_of(arena, block);
+    if(shard == NULL){
+        report_error(arena, MEM_OP_RESIZE, MEM_ERROR_INVALID_BLOCK, block, size);
+        return NULL;
+    }
+
+    void* resized = arena_resize(shard, block, size, timer);
+    if(resized != NULL)
+        return resized;
+    if(last_error != MEM_ERROR_NO_SPACE){
+        report_error(arena, MEM_OP_RESIZE, last_error, block, size);
+        return NULL;
+    }
+
+    // The move shows up in the shards' statistics as an allocation and a free, the arena counts it as a resize
+    size_t old_size = allocated_size(shard, block);
+    void* new_block = shards_alloc(arena, size, 0, false, timer);
+    if(new_block == NULL){
+        report_error(arena, MEM_OP_RESIZE, MEM_ERROR_NO_SPACE, block, size);
+        return NULL;
+    }
+
+    memcpy(new_block, block, old_size < size ? old_size : size);
+    arena_free(shard, block, timer);
+    count_op(&arena->resizes, 1);
+    return new_block;
+}
+
+// Allocates a batch from the calling thread's home shard, and what that one can't hold from the others in turn
+static size_t sharded_alloc_batch(mem_arena* arena, size_t size, size_t count, void** out, op_timer* timer){
+    if(thread_number == 0)
+        thread_number = __atomic_add_fetch(&thread_count, 1, __ATOMIC_RELAXED);
+    unsigned int home = (thread_number - 1) % arena->shard_count;
+
+    size_t allocated = 0;
+    for(unsigned int i = 0; i < arena->shard_count && allocated < count; i++){
+        mem_arena* shard = &arena->shards[(home + i) % arena->shard_count];
+        allocated += arena_alloc_batch(shard, size, count - allocated, out + allocated, timer);
+    }
+    return allocated;
+}
+
+// Frees a sorted batch, handing each shard the run of blocks that lies in it.
+// Returns the number of blocks that could not be freed, with the first of them in 'invalid'
+static size_t sharded_free_batch(mem_arena* arena, void** blocks, size_t count, void** invalid, op_timer* timer){
+    size_t failures = 0;
+    size_t i = 0;
+
+    // Sorted, the NULLs come first
+    while(i < count && blocks[i] == NULL)
+        i++;
+
+    while(i < count){
+        mem_arena* shard = shard_of(arena, blocks[i]);
+        size_t run = 1;
+        while(i + run < count && shard_of(arena, blocks[i + run]) == shard)
+            run++;
+
+        void* first_invalid = blocks[i];
+        size_t run_failures = shard == NULL ? run : arena_free_batch(shard, blocks + i, run, &first_invalid, timer);
+        if(run_failures > 0 && failures == 0)
+            *invalid = first_invalid;
+        failures += run_failures;
+        i += run;
+    }
+    return failures;
+}
+
+void* mem_arena_alloc(mem_arena* arena, size_t size){
+    op_timer timer;
+    op_timer_start(arena, &timer);
+    void* result = arena->shard_count > 0 ? sharded_alloc(arena, size, 0, false, &timer) : arena_alloc(arena, size, &timer);
+    op_timer_stop(arena, &timer, MEM_OP_ALLOC);
+    return result;
+}
+
+void* mem_arena_alloc_aligned(mem_arena* arena, size_t size, size_t alignment){
+    op_timer timer;
+    op_timer_start(arena, &timer);
+    void* result = arena->shard_count > 0 ? sharded_alloc(arena, size, alignment, false, &timer) : arena_alloc_aligned(arena, size, alignment, &timer);
+    op_timer_stop(arena, &timer, MEM_OP_ALLOC);
+    return result;
+}
+
+void* mem_arena_calloc(mem_arena* arena, size_t count, size_t size){
+    if(size != 0 && count > (size_t)-1 / size){
+        report_error(arena, MEM_OP_ALLOC, MEM_ERROR_NO_SPACE, NULL, (size_t)-1);
+        return NULL;
+    }
+
+    op_timer timer;
+    op_timer_start(arena, &timer);
+    void* result = arena->shard_count > 0 ? sharded_alloc(arena, count * size, 0, true, &timer) : arena_calloc(arena, count * size, &timer);
+    op_timer_stop(arena, &timer, MEM_OP_ALLOC);
+    return result;
+}
+
+void mem_arena_free(mem_arena* arena, void* block){
+    op_timer timer;
+    op_timer_start(arena, &timer);
+    if(arena->shard_count > 0)
+        sharded_free(arena, block, &timer);
+    else
+        arena_free(arena, block, &timer);
+    op_timer_stop(arena, &timer, MEM_OP_FREE);
+}
+
+void* mem_arena_resize(mem_arena* arena, void* block, size_t size){
+    op_timer timer;
+    op_timer_start(arena, &timer);
+    void* result = arena->shard_count > 0 ? sharded_resize(arena, block, size, &timer) : arena_resize(arena, block, size, &timer);
+    op_timer_stop(arena, &timer, MEM_OP_RESIZE);
+    return result;
+}
+
+// Batches are not timed, a batch's latency would skew the histograms of single calls
+size_t mem_arena_alloc_batch(mem_arena* arena, size_t size, size_t count, void** out){
+    if(count == 0)
+        return 0;
+    if(size == 0)
+        size = 1;
+
+    size_t rounded_size = round_to_min_alignment(arena, size);
+    if(rounded_size == 0){
+        report_error(arena, MEM_OP_ALLOC, MEM_ERROR_NO_SPACE, NULL, size);
+        return 0;
+    }
+
+    op_timer timer = {0};
+    size_t allocated = arena->shard_count > 0 ? sharded_alloc_batch(arena, rounded_size, count, out, &timer)
+                                              : arena_alloc_batch(arena, rounded_size, count, out, &timer);
+    if(allocated < count)
+        report_error(arena, MEM_OP_ALLOC, MEM_ERROR_NO_SPACE, NULL, size);
+    return allocated;
+}
+
+void mem_arena_free_batch(mem_arena* arena, void** blocks, size_t count){
+    if(count == 0)
+        return;
+
+    qsort(blocks, count, sizeof(void*), compare_addresses);
+
+    op_timer timer = {0};
+    void* invalid = NULL;
+    size_t failures = arena->shard_count > 0 ? sharded_free_batch(arena, blocks, count, &invalid, &timer)
+                                             : arena_free_batch(arena, blocks, count, &invalid, &timer);
+    if(failures > 0)
+        report_error(arena, MEM_OP_FREE, MEM_ERROR_INVALID_BLOCK, invalid, 0);
+}
+
+// The highest non-empty size class, which holds the largest free block, or -1 if there are no free blocks
+static int largest_free_class(mem_arena* arena){
+    if(arena->free_list_map == 0)
+        return -1;
+    return SIZE_CLASS_COUNT - 1 - __builtin_clzll(arena->free_list_map);
+}
+
+// The largest free block is the largest of the highest non-empty size class
+static size_t largest_free_block(mem_arena* arena){
+    int class = largest_free_class(arena);
+    return class < 0 ? 0 : arena->free_list_largest[class];
+}
+
+// Searches 'class' for its largest block, once the ones it had have all been taken out
+static void free_list_find_largest(mem_arena* arena, int class){
+    size_t largest = 0;
+    size_t count = 0;
+    for(memory_block* walker = arena->free_lists[class]; walker != NULL; walker = walker->next_free){
+        if(walker->block_size > largest){
+            largest = walker->block_size;
+            count = 0;
+        }
+        if(walker->block_size == largest)
+            count++;
+    }
+    arena->free_list_largest[class] = largest;
+    arena->free_list_largest_count[class] = count;
+}
+
+// Adds an unsharded arena's figures to 'stats', only keeping the largest free block of those added
+static void arena_stats_add(mem_arena* arena, struct mem_stats* stats){
+    pthread_rwlock_rdlock(&arena->lock);
+
+    // An out of date largest block has to be searched for, which changes the arena
+    int class = largest_free_class(arena);
+    if(class >= 0 && arena->free_list_largest_count[class] == 0){
+        pthread_rwlock_unlock(&arena->lock);
+        pthread_rwlock_wrlock(&arena->lock);
+        class = largest_free_class(arena);
+        if(class >= 0 && arena->free_list_largest_count[class] == 0)
+            free_list_find_largest(arena, class);
+    }
+
+    stats->bytes_free += arena->free_bytes;
+    stats->free_block_count += arena->free_block_count;
+    size_t largest = largest_free_block(arena);
+    if(largest > stats->largest_free_block)
+        stats->largest_free_block = largest;
+
+    stats->allocs += __atomic_load_n(&arena->allocs, __ATOMIC_RELAXED);
+    stats->frees += __atomic_load_n(&arena->frees, __ATOMIC_RELAXED);
+    stats->resizes += __atomic_load_n(&arena->resizes, __ATOMIC_RELAXED);
+    stats->alloc_failures += __atomic_load_n(&arena->alloc_failures, __ATOMIC_RELAXED);
+    stats->free_failures += __atomic_load_n(&arena->free_failures, __ATOMIC_RELAXED);
+    stats->resize_failures += __atomic_load_n(&arena->resize_failures, __ATOMIC_RELAXED);
+
+    // Add what the thread caches served on their own
+    for(thread_cache* cache = arena->thread_caches; cache != NULL; cache = cache->next_cache){
+        stats->allocs += __atomic_load_n(&cache->allocs, __ATOMIC_RELAXED);
+        stats->frees += __atomic_load_n(&cache->frees, __ATOMIC_RELAXED);
+    }
+
+    pthread_rwlock_unlock(&arena->lock);
+}
+
+void mem_arena_stats(mem_arena* arena, struct mem_stats* stats){
+    memset(stats, 0, sizeof(struct mem_stats));
+
+    // A sharded arena only has the failures and cross-shard resizes counted itself, the shards have the rest
+    arena_stats_add(arena, stats);
+    for(unsigned int i = 0; i < arena->shard_count; i++){
+        arena_stats_add(&arena->shards[i], stats);
+    }
+
+    stats->bytes_used = arena->size - stats->bytes_free;
+    stats->fragmentation = stats->bytes_free > 0 ? 1.0 - (double)stats->largest_free_block / stats->bytes_free : 0.0;
+}
+
+void mem_arena_latency_snapshot(mem_arena* arena, mem_latency* latency){
+    memset(latency, 0, sizeof(mem_latency));
+    if(!(arena->options.flags & MEM_INSTRUMENT))
+        return;
+
+    pthread_mutex_lock(&arena->latency_lock);
+    latency_add(latency, arena->retired_latency);
+    for(latency_recorder* recorder = arena->latency_recorders; recorder != NULL; recorder = recorder->next_recorder){
+        latency_add(latency, &recorder->latency);
+    }
+    pthread_mutex_unlock(&arena->latency_lock);
+}
+
+void mem_arena_latency_reset(mem_arena* arena){
+    if(!(arena->options.flags & MEM_INSTRUMENT))
+        return;
+
+    pthread_mutex_lock(&arena->latency_lock);
+    latency_clear(arena->retired_latency);
+    for(latency_recorder* recorder = arena->latency_recorders; recorder != NULL; recorder = recorder->next_recorder){
+        latency_clear(&recorder->latency);
+    }
+    pthread_mutex_unlock(&arena->latency_lock);
+}
+
+unsigned long long mem_histogram_percentile(const mem_histogram* histogram, double percentile){
+    if(histogram->count == 0)
+        return 0;
+
+    // The rank of the value asked for, counting from 1
+    unsigned long long rank = (unsigned long long)(percentile / 100.0 * histogram->count + 0.5);
+    if(rank < 1)
+        rank = 1;
+
+    unsigned long long seen = 0;
+    for(int i = 0; i < MEM_HISTOGRAM_BUCKETS; i++){
+        seen += histogram->counts[i];
+        if(seen >= rank){
+            unsigned long long limit = histogram_bucket_limit(i);
+            return limit < histogram->max ? limit : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+void mem_arena_set_error_callback(mem_arena* arena, mem_error_callback callback, void* user_data){
+    arena->error_callback = callback;
+    arena->error_callback_data = user_data;
+}
+
+void mem_arena_destroy(mem_arena* arena){
+    DEBUG(printf("mem_arena_destroy "));
+
+    if(arena == NULL)
+        return;
+
+    arena_deinit(arena);
+    free(arena);
+}
+
+void* mem_alloc(size_t size){
+    return mem_arena_alloc(&default_arena, size);
+}
+
+void* mem_alloc_aligned(size_t size, size_t alignment){
+    return mem_arena_alloc_aligned(&default_arena, size, alignment);
+}
+
+void* mem_calloc(size_t count, size_t size){
+    return mem_arena_calloc(&default_arena, count, size);
+}
+
+void mem_free(void* block){
+    mem_arena_free(&default_arena, block);
+}
+
+void* mem_resize(void* block, size_t size){
+    return mem_arena_resize(&default_arena, block, size);
+}
+
+size_t mem_alloc_batch(size_t size, size_t count, void** out){
+    return mem_arena_alloc_batch(&default_arena, size, count, out);
+}
+
+void mem_free_batch(void** blocks, size_t count){
+    mem_arena_free_batch(&default_arena, blocks, count);
+}
+
+void mem_stats(struct mem_stats* stats){
+    mem_arena_stats(&default_arena, stats);
+}
+
+void mem_latency_snapshot(mem_latency* latency){
+    mem_arena_latency_snapshot(&default_arena, latency);
+}
+
+void mem_latency_reset(){
+    mem_arena_latency_reset(&default_arena);
+}
+
+void mem_set_error_callback(mem_error_callback callback, void* user_data){
+    mem_arena_set_error_callback(&default_arena, callback, user_data);
+}
+
+mem_error mem_last_error(){
+    return last_error;
+}
+
+const char* mem_strerror(mem_error error){
+    switch(error){
+    case MEM_OK:
+        return "no error";
+    case MEM_ERROR_NO_SPACE:
+        return "no space in memory";
+    case MEM_ERROR_INVALID_BLOCK:
+        return "no such block";
+    case MEM_ERROR_INVALID_ARGUMENT:
+        return "invalid argument";
+    case MEM_ERROR_SYSTEM:
+        return "the system is out of memory";
+    default:
+        return "unknown error";
+    }
+}
+
+// Frees all memory that was allocated using malloc
+void mem_deinit(){
+    DEBUG(printf("mem_deinit "));
+
+    arena_deinit(&default_arena);
+}
+
+// Slab header, placed at the start of the slab's block in the pool with the objects behind it
+struct mem_slab{
+    void* block;     // The pool block holding the slab, as returned by mem_alloc
+    char* objects;
+    size_t stride;   // Distance between two objects, at least large enough for a free list link
+    size_t capacity;
+
+    // Top of the free object stack: the low 32 bits hold the index + 1 of the top object
+    // (0 when empty), the high 32 bits a tag bumped on every change so a stale pop can't succeed (ABA)
+    unsigned long long free_top;
+};
+
+// Free objects store the index + 1 of the object below them on the stack in their first bytes
+static unsigned int* slab_link(mem_slab* slab, unsigned int index){
+    return (unsigned int*)(slab->objects + (size_t)index * slab->stride);
+}
+
+mem_slab* mem_slab_create(size_t obj_size, size_t capacity){
+    DEBUG(printf("mem_slab_create: %lu x %lu ", obj_size, capacity));
+
+    if(capacity == 0 || capacity >= 0xFFFFFFFFUL){
+        report_error(&default_arena, MEM_OP_COUNT, MEM_ERROR_INVALID_ARGUMENT, NULL, capacity);
+        return NULL;
+    }
+
+    // Objects need room for the free list link, and are kept naturally aligned up to 8 bytes
+    size_t stride = obj_size < sizeof(unsigned int) ? sizeof(unsigned int) : obj_size;
+    size_t alignment = stride >= 8 ? 8 : stride >= 4 ? 4 : 1;
+    stride = (stride + alignment - 1) & ~(alignment - 1);
+
+    // Pool blocks start at any byte, so leave room to align the header
+    size_t header_size = (sizeof(mem_slab) + 7) & ~(size_t)7;
+    void* block = mem_alloc(7 + header_size + stride * capacity);
+    if(block == NULL)
+        return NULL;
+
+    mem_slab* slab = (mem_slab*)(((size_t)block + 7) & ~(size_t)7);
+    slab->block = block;
+    slab->objects = (char*)slab + header_size;
+    slab->stride = stride;
+    slab->capacity = capacity;
+
+    // Stack all objects up so they are handed out from the lowest address
+    for(unsigned int i = 0; i < capacity; i++){
+        *slab_link(slab, i) = i + 1 < capacity ? i + 2 : 0;
+    }
+    slab->free_top = 1;
+
+    return slab;
+}
+
+void* mem_slab_alloc(mem_slab* slab){
+    unsigned long long top = __atomic_load_n(&slab->free_top, __ATOMIC_ACQUIRE);
+    unsigned long long new_top;
+    unsigned int index;
+
+    do{
+        index = (unsigned int)top;
+        if(index == 0)
+            return NULL;
+
+        // The object may be popped and written to by another thread meanwhile,
+        // in which case the tag has moved on and the exchange below fails
+        unsigned int below = __atomic_load_n(slab_link(slab, index - 1), __ATOMIC_RELAXED);
+        new_top = ((top >> 32) + 1) << 32 | below;
+    } while(!__atomic_compare_exchange_n(&slab->free_top, &top, new_top, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+    return slab->objects + (size_t)(index - 1) * slab->stride;
+}
+
+void mem_slab_free(mem_slab* slab, void* obj){
+    if(obj == NULL)
+        return;
+
+    size_t offset = (size_t)((char*)obj - slab->objects);
+    if((char*)obj < slab->objects || offset % slab->stride != 0 || offset / slab->stride >= slab->capacity){
+        report_error(&default_arena, MEM_OP_COUNT, MEM_ERROR_INVALID_BLOCK, obj, 0);
+        return;
+    }
+    unsigned int index = (unsigned int)(offset / slab->stride);
+
+    unsigned long long top = __atomic_load_n(&slab->free_top, __ATOMIC_RELAXED);
+    unsigned long long new_top;
+    do{
+        __atomic_store_n(slab_link(slab, index), (unsigned int)top, __ATOMIC_RELAXED);
+        new_top = ((top >> 32) + 1) << 32 | (index + 1);
+    } while(!__atomic_compare_exchange_n(&slab->free_top, &top, new_top, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+void mem_slab_destroy(mem_slab* slab){
+    if(slab != NULL)
+        mem_free(slab->block);
+}
+
+struct mem_region{
+    void* block;   // The pool block holding the region, as returned by mem_alloc
+    char* memory;
+    size_t capacity;
+    size_t used;   // Bytes handed out from the start of 'memory'
+};
+
+mem_region* mem_region_begin(size_t capacity){
+    DEBUG(printf("mem_region_begin: %lu ", capacity));
+
+    // Pool blocks start at any byte, so leave room to align the header and the memory behind it
+    size_t header_size = (sizeof(mem_region) + 7) & ~(size_t)7;
+    if(capacity > (size_t)-1 - 7 - header_size){
+        report_error(&default_arena, MEM_OP_COUNT, MEM_ERROR_INVALID_ARGUMENT, NULL, capacity);
+        return NULL;
+    }
+
+    void* block = mem_alloc(7 + header_size + capacity);
+    if(block == NULL)
+        return NULL;
+
+    mem_region* region = (mem_region*)(((size_t)block + 7) & ~(size_t)7);
+    region->block = block;
+    region->memory = (char*)region + header_size;
+    region->capacity = capacity;
+    region->used = 0;
+
+    return region;
+}
+
+void* mem_region_alloc(mem_region* region, size_t size){
+    // Objects are kept 8 byte aligned, like those of a slab
+    if(size > region->capacity)
+        return NULL;
+    size = (size + 7) & ~(size_t)7;
+
+    size_t used = __atomic_load_n(&region->used, __ATOMIC_RELAXED);
+    do{
+        if(size > region->capacity - used)
+            return NULL;
+    } while(!__atomic_compare_exchange_n(&region->used, &used, used + size, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    return region->memory + used;
+}
+
+void mem_region_reset(mem_region* region){
+    __atomic_store_n(&region->used, 0, __ATOMIC_RELAXED);
+}
+
+void mem_region_end(mem_region* region){
+    if(region != NULL)
+        mem_free(region->block);
+}
+
+// The slot a handle refers to, or NULL if the handle is invalid. Needs the pool lock, shared will do
+static handle_entry* handle_entry_of(mem_arena* arena, mem_handle handle){
+    unsigned int index = (unsigned int)handle;
+    if(index == 0 || index > arena->handle_capacity)
+        return NULL;
+
+    handle_entry* entry = &arena->handles[index - 1];
+    if(entry->block == NULL || entry->generation != (unsigned int)(handle >> 32))
+        return NULL;
+    return entry;
+}
+
+// Takes a free slot from the handle table, growing it if there is none. Needs the pool lock
+static handle_entry* handle_entry_alloc(mem_arena* arena){
+    if(arena->free_handle == 0){
+        unsigned int capacity = arena->handle_capacity == 0 ? HANDLE_TABLE_INITIAL_SIZE : arena->handle_capacity * 2;
+        handle_entry* handles = realloc(arena->handles, capacity * sizeof(handle_entry));
+        if(handles == NULL)
+            return NULL;
+
+        for(unsigned int i = arena->handle_capacity; i < capacity; i++){
+            handles[i] = (handle_entry){NULL, 0, 0, i + 1 < capacity ? i + 2 : 0};
+        }
+        arena->free_handle = arena->handle_capacity + 1;
+        arena->handles = handles;
+        arena->handle_capacity = capacity;
+    }
+
+    handle_entry* entry = &arena->handles[arena->free_handle - 1];
+    arena->free_handle = entry->next_free;
+    return entry;
+}
+
+mem_handle mem_arena_halloc(mem_arena* arena, size_t size){
+    DEBUG(printf("mem_halloc: %lu ", size));
+
+    if(arena->shard_count > 0){
+        report_error(arena, MEM_OP_ALLOC, MEM_ERROR_INVALID_ARGUMENT, NULL, size);
+        return 0;
+    }
+
+    size_t rounded_size = round_to_min_alignment(arena, size == 0 ? 1 : size);
+    if(rounded_size == 0){
+        report_error(arena, MEM_OP_ALLOC, MEM_ERROR_NO_SPACE, NULL, size);
+        return 0;
+    }
+
+    // Until the block has its handle compaction leaves it where it is, so it doesn't matter that
+    // the lock is let go in between. Handle blocks never go through the thread caches
+    op_timer timer;
+    op_timer_start(arena, &timer);
+    void* start = pool_alloc(arena, rounded_size, arena->options.min_alignment, false, &timer);
+    if(start == NULL){
+        op_timer_stop(arena, &timer, MEM_OP_ALLOC);
+        return 0;
+    }
+
+    arena_lock(arena, &timer);
+    memory_block* block = block_table_find(arena, start);
+    handle_entry* entry = handle_entry_alloc(arena);
+    if(entry == NULL){
+        release_block(arena, block);
+        arena_unlock(arena, &timer);
+        op_timer_stop(arena, &timer, MEM_OP_ALLOC);
+        report_error(arena, MEM_OP_ALLOC, MEM_ERROR_SYSTEM, NULL, size);
+        return 0;
+    }
+
+    unsigned int index = (unsigned int)(entry - arena->handles);
+    entry->block = block;
+    entry->pins = 0;
+    block->handle = index + 1;
+    mem_handle handle = (mem_handle)entry->generation << 32 | (index + 1);
+    arena_unlock(arena, &timer);
+
+    op_timer_stop(arena, &timer, MEM_OP_ALLOC);
+    return handle;
+}
+
+void* mem_arena_hlock(mem_arena* arena, mem_handle handle){
+    // Compaction moves blocks under the exclusive lock, so it never sees a pin half taken
+    pthread_rwlock_rdlock(&arena->lock);
+    handle_entry* entry = handle_entry_of(arena, handle);
+    if(entry == NULL){
+        pthread_rwlock_unlock(&arena->lock);
+        report_error(arena, MEM_OP_COUNT, MEM_ERROR_INVALID_BLOCK, NULL, 0);
+        return NULL;
+    }
+
+    __atomic_add_fetch(&entry->pins, 1, __ATOMIC_RELAXED);
+    void* start = entry->block->start;
+    pthread_rwlock_unlock(&arena->lock);
+
+    return start;
+}
+
+void mem_arena_hunlock(mem_arena* arena, mem_handle handle){
+    // The table may be reallocated as it grows, so even this needs the lock
+    pthread_rwlock_rdlock(&arena->lock);
+    handle_entry* entry = handle_entry_of(arena, handle);
+    bool pinned = entry != NULL && __atomic_load_n(&entry->pins, __ATOMIC_RELAXED) > 0;
+    if(pinned)
+        __atomic_sub_fetch(&entry->pins, 1, __ATOMIC_RELEASE);
+    pthread_rwlock_unlock(&arena->lock);
+
+    if(!pinned)
+        report_error(arena, MEM_OP_COUNT, MEM_ERROR_INVALID_BLOCK, NULL, 0);
+}
+
+void mem_arena_hfree(mem_arena* arena, mem_handle handle){
+    DEBUG(printf("mem_hfree: %llu ", handle));
+
+    if(handle == 0)
+        return;
+
+    op_timer timer;
+    op_timer_start(arena, &timer);
+    arena_lock(arena, &timer);
+
+    handle_entry* entry = handle_entry_of(arena, handle);
+    if(entry == NULL){
+        arena_unlock(arena, &timer);
+        op_timer_stop(arena, &timer, MEM_OP_FREE);
+        report_error(arena, MEM_OP_FREE, MEM_ERROR_INVALID_BLOCK, NULL, 0);
+        return;
+    }
+
+    entry->block->handle = 0;
+    release_block(arena, entry->block);
+    count_op(&arena->frees, 1);
+
+    entry->block = NULL;
+    entry->generation++;
+    entry->next_free = arena->free_handle;
+    arena->free_handle = (unsigned int)(entry - arena->handles) + 1;
+
+    arena_unlock(arena, &timer);
+    op_timer_stop(arena, &timer, MEM_OP_FREE);
+}
+
+// Whether compaction may move an allocated block. Needs the pool lock, shared will do
+static bool block_movable(mem_arena* arena, memory_block* block){
+    return !block->free && block->handle != 0 && __atomic_load_n(&arena->handles[block->handle - 1].pins, __ATOMIC_ACQUIRE) == 0;
+}
+
+// The lowest addressed free block that a movable block follows, or NULL. Needs the pool lock, shared will do
+static memory_block* find_hole(mem_arena* arena){
+    for(memory_block* walker = arena->memory_block_head; walker != NULL; walker = walker->next){
+        memory_block* next_block = walker->next;
+        if(walker->free && next_block != NULL && block_movable(arena, next_block))
+            return walker;
+    }
+    return NULL;
+}
+
+// Slides the movable blocks behind the free block 'hole' down into it one after another, until a
+// block that can't be moved is reached or 'max_bytes' have been moved. The hole moves up behind
+// them and takes in the free blocks it meets. Returns the number of bytes moved. Needs the pool lock
+static size_t slide_blocks(mem_arena* arena, memory_block* hole, size_t max_bytes){
+    size_t moved = 0;
+    free_list_remove(arena, hole);
+
+    while(moved == 0 || moved < max_bytes){
+        memory_block* block = hole->next;
+        if(block == NULL)
+            break;
+
+        if(block->free){
+            free_list_remove(arena, block);
+            absorb_next_block(arena, hole);
+            continue;
+        }
+        if(!block_movable(arena, block))
+            break;
+
+        // The block takes over the front of the hole, the descriptors swap places in the block list
+        block_table_remove(arena, block);
+        memmove(hole->start, block->start, block->block_size);
+        block->start = hole->start;
+        hole->start = (char*)block->start + block->block_size;
+        block_table_insert(arena, block);
+
+        memory_block* block_preceding = hole->prev;
+        memory_block* next_block = block->next;
+        block->prev = block_preceding;
+        block->next = hole;
+        hole->prev = block;
+        hole->next = next_block;
+        if(block_preceding != NULL)
+            block_preceding->next = block;
+        else
+            arena->memory_block_head = block;
+        if(next_block != NULL)
+            next_block->prev = hole;
+
+        moved += block->block_size;
+    }
+
+    hole->zeroed = false;
+    free_list_insert(arena, hole);
+    release_pages(arena, hole);
+    return moved;
+}
+
+size_t mem_arena_compact(mem_arena* arena, size_t max_bytes){
+    if(arena->shard_count > 0)
+        return 0;
+
+    // As with first fit allocations, the walk for a hole only reads, so it runs under the shared lock.
+    // Compaction is not one of the measured calls, so its timer stays off
+    op_timer timer = {0};
+    arena_lock_shared(arena, &timer);
+    memory_block* hole = find_hole(arena);
+    arena_unlock(arena, &timer);
+    if(hole == NULL)
+        return 0;
+
+    // If the pool changed in between, the walk is done again
+    arena_lock(arena, &timer);
+    if(!hole->free || hole->next == NULL || !block_movable(arena, hole->next))
+        hole = find_hole(arena);
+    size_t moved = hole != NULL ? slide_blocks(arena, hole, max_bytes) : 0;
+    arena_unlock(arena, &timer);
+
+    return moved;
+}
+
+static void* compactor_main(void* arg){
+    mem_arena* arena = arg;
+
+    pthread_mutex_lock(&arena->compactor_lock);
+    while(arena->compactor_running){
+        pthread_mutex_unlock(&arena->compactor_lock);
+        size_t moved = mem_arena_compact(arena, COMPACT_STEP_BYTES);
+        pthread_mutex_lock(&arena->compactor_lock);
+
+        // Steps follow each other straight away while there is work, letting the pool lock go in between
+        if(moved == 0 && arena->compactor_running){
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_sec += arena->compactor_interval_ms / 1000;
+            until.tv_nsec += (long)(arena->compactor_interval_ms % 1000) * 1000000;
+            if(until.tv_nsec >= 1000000000){
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&arena->compactor_wake, &arena->compactor_lock, &until);
+        }
+    }
+    pthread_mutex_unlock(&arena->compactor_lock);
+
+    return NULL;
+}
+
+bool mem_arena_compactor_start(mem_arena* arena, unsigned int interval_ms){
+    pthread_mutex_lock(&arena->compactor_lock);
+    arena->compactor_interval_ms = interval_ms;
+    if(!arena->compactor_running){
+        arena->compactor_running = true;
+        if(pthread_create(&arena->compactor, NULL, compactor_main, arena) != 0){
+            arena->compactor_running = false;
+            pthread_mutex_unlock(&arena->compactor_lock);
+            report_error(arena, MEM_OP_COUNT, MEM_ERROR_SYSTEM, NULL, 0);
+            return false;
+        }
+    }
+    pthread_mutex_unlock(&arena->compactor_lock);
+
+    return true;
+}
+
+void mem_arena_compactor_stop(mem_arena* arena){
+    pthread_mutex_lock(&arena->compactor_lock);
+    bool running = arena->compactor_running;
+    arena->compactor_running = false;
+    pthread_cond_signal(&arena->compactor_wake);
+    pthread_mutex_unlock(&arena->compactor_lock);
+
+    if(running)
+        pthread_join(arena->compactor, NULL);
+}
+
+mem_handle mem_halloc(size_t size){
+    return mem_arena_halloc(&default_arena, size);
+}
+
+void* mem_hlock(mem_handle handle){
+    return mem_arena_hlock(&default_arena, handle);
+}
+
+void mem_hunlock(mem_handle handle){
+    mem_arena_hunlock(&default_arena, handle);
+}
+
+void mem_hfree(mem_handle handle){
+    mem_arena_hfree(&default_arena, handle);
+}
+
+size_t mem_compact(size_t max_bytes){
+    return mem_arena_compact(&default_arena, max_bytes);
+}
+
+bool mem_compactor_start(unsigned int interval_ms){
+    return mem_arena_compactor_start(&default_arena, interval_ms);
+}
+
+void mem_compactor_stop(){
+    mem_arena_compactor_stop(&default_arena);
+}
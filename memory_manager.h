@@ -20,8 +20,124 @@ extern "C"
         size_t block_size;
         _Bool free;
         void* next;
+        struct memory_block* prev;      // Previous block in address order
+        struct memory_block* hash_next; // Next allocated block in the same lookup table bucket
+        struct memory_block* prev_free; // Neighbours in the size class free list,
+        struct memory_block* next_free; // only used while the block is free
+        struct memory_block* tree_left;  // Children in the best fit index, ordered by size then address,
+        struct memory_block* tree_right; // only used while the block is free under MEM_POLICY_BEST_FIT
+        void* cache;                    // Thread cache holding the block, NULL while the shared pool owns it
+        _Bool zeroed;                   // The whole pages inside the free block are known to read as zero,
+                                        // as they were never touched or were handed back to the OS
+        unsigned int handle;            // Index + 1 of the handle the block was allocated through, 0 if none
     } memory_block;
 
+    /**
+     * Strategies for choosing which free block an allocation is placed in.
+     */
+    typedef enum mem_policy{
+        MEM_POLICY_SEGREGATED_FIT = 0, // Smallest non-empty power-of-two size class that fits (default)
+        MEM_POLICY_FIRST_FIT,          // Lowest addressed free block that fits
+        MEM_POLICY_NEXT_FIT,           // First block that fits, searching on from where the last search ended
+        MEM_POLICY_BEST_FIT,           // Smallest free block that fits, found through a balanced tree
+    } mem_policy;
+
+    // Flags for mem_options.flags
+    #define MEM_NO_THREAD_CACHE 0x1 // Free every block straight into the pool instead of caching it per thread
+    #define MEM_MMAP            0x2 // Map the pool with mmap, so pages are only committed once touched and
+                                    // large free blocks hand their pages back to the OS
+    #define MEM_HUGE_PAGES      0x4 // Implies MEM_MMAP. Back the pool with huge pages, or at least ask for
+                                    // transparent huge pages if none are reserved
+    #define MEM_INSTRUMENT      0x8 // Record the latency of every allocation, free and resize, see mem_latency_snapshot
+
+    /**
+     * Settings for mem_init_ex. A zero initialized struct gives the same behaviour as mem_init.
+     */
+    typedef struct mem_options{
+        mem_policy policy;
+        unsigned int flags;
+        size_t min_alignment; // Power of two every block is aligned to and sized in multiples of, 0 or 1 for none
+        size_t release_threshold; // Mapped pools only: free blocks this large return their pages, 0 for 1 MiB
+        unsigned int shards;      // Equally sized parts to split the pool into, each with its own lock, 0 or 1 for none.
+                                  // Threads allocate from a shard of their own until it is full. A single block can't
+                                  // be larger than a shard
+    } mem_options;
+
+    #define MEM_MAX_SHARDS 64
+
+    /**
+     * A snapshot of a pool's usage, as filled in by mem_stats. Blocks kept in thread caches count as used.
+     */
+    struct mem_stats{
+        size_t bytes_used;
+        size_t bytes_free;
+        size_t largest_free_block;
+        size_t free_block_count;
+        double fragmentation; // 1 - largest_free_block / bytes_free, i.e. how much free space is not in the largest block
+
+        // Operations since the pool was initialized, failed ones counted separately
+        unsigned long long allocs;
+        unsigned long long frees;
+        unsigned long long resizes;
+        unsigned long long alloc_failures;
+        unsigned long long free_failures;
+        unsigned long long resize_failures;
+    };
+
+    /**
+     * Reasons a call can fail for, as returned by mem_last_error and passed to the error callback.
+     */
+    typedef enum mem_error{
+        MEM_OK = 0,
+        MEM_ERROR_NO_SPACE,         // No free block is large enough for the request
+        MEM_ERROR_INVALID_BLOCK,    // The pointer is not an allocated block of the pool, e.g. it was already freed
+        MEM_ERROR_INVALID_ARGUMENT, // E.g. an alignment that is not a power of two
+        MEM_ERROR_SYSTEM,           // The system heap couldn't provide memory for a pool or its bookkeeping
+    } mem_error;
+
+    /**
+     * Called when a call fails, after the pool lock has been released. 'block' and 'size'
+     * are the pointer and size the failed call was given, where it has them.
+     */
+    typedef void (*mem_error_callback)(mem_error error, void *block, size_t size, void *user_data);
+
+    /**
+     * Operations, and phases of an operation, whose latency is recorded under MEM_INSTRUMENT.
+     */
+    typedef enum mem_op{
+        MEM_OP_ALLOC = 0, // mem_alloc and mem_alloc_aligned
+        MEM_OP_FREE,
+        MEM_OP_RESIZE,
+        MEM_OP_COUNT
+    } mem_op;
+
+    typedef enum mem_phase{
+        MEM_PHASE_TOTAL = 0, // The whole call
+        MEM_PHASE_LOCK_WAIT, // Waiting for the pool lock. Not recorded for calls served by a thread cache alone
+        MEM_PHASE_SEARCH,    // Holding the pool lock to find and update blocks. Not recorded for those calls either
+        MEM_PHASE_COUNT
+    } mem_phase;
+
+    // Latency histograms count nanoseconds in log-linear buckets: every power of two is split into
+    // MEM_HISTOGRAM_SUB_BUCKETS buckets, so a bucket is at most 1/16th of its values wide.
+    // The buckets reach up to 2^40 ns (about 18 minutes), longer latencies are counted in the last one
+    #define MEM_HISTOGRAM_SUB_BUCKETS 16
+    #define MEM_HISTOGRAM_BUCKETS (37 * MEM_HISTOGRAM_SUB_BUCKETS)
+
+    typedef struct mem_histogram{
+        unsigned long long counts[MEM_HISTOGRAM_BUCKETS];
+        unsigned long long count;
+        unsigned long long sum; // In nanoseconds, for the mean
+        unsigned long long max;
+    } mem_histogram;
+
+    /**
+     * The latency histograms of every operation and phase, as filled in by mem_latency_snapshot.
+     */
+    typedef struct mem_latency{
+        mem_histogram histograms[MEM_OP_COUNT][MEM_PHASE_COUNT];
+    } mem_latency;
+
     /**
      * Initializes the memory manager with a specified size of memory pool.
      * The memory pool could be any data structure, for instance, a large array
@@ -31,6 +147,15 @@ extern "C"
      */
     void mem_init(size_t size);
 
+    /**
+     * Initializes the memory manager like mem_init, with the placement policy and
+     * other settings taken from 'options'.
+     *
+     * @param size The size of the memory pool to initialize.
+     * @param options The settings to use, or NULL for the defaults.
+     */
+    void mem_init_ex(size_t size, const mem_options *options);
+
     /**
      * Allocates a block of memory of the specified size. This function finds a
      * suitable block in the pool, marks it as allocated, and returns a pointer
@@ -41,6 +166,29 @@ extern "C"
      */
     void *mem_alloc(size_t size);
 
+    /**
+     * Allocates a block of memory of the specified size, starting at an address that
+     * is a multiple of 'alignment'. Any space skipped to reach that address stays
+     * free in the pool.
+     *
+     * @param size The size of the memory block to allocate.
+     * @param alignment The alignment of the block, a power of two.
+     * @return A pointer to the allocated memory block, or NULL if allocation fails.
+     */
+    void *mem_alloc_aligned(size_t size, size_t alignment);
+
+    /**
+     * Allocates a block of memory for an array of 'count' elements of 'size' bytes each,
+     * with every byte set to zero. In a pool mapped with MEM_MMAP, whole pages that were
+     * never used or were handed back to the OS already read as zero and are not cleared again,
+     * so large zeroed allocations cost little more than mem_alloc.
+     *
+     * @param count The number of elements.
+     * @param size The size of each element.
+     * @return A pointer to the allocated memory block, or NULL if allocation fails.
+     */
+    void *mem_calloc(size_t count, size_t size);
+
     /**
      * Frees the specified block of memory. This function marks the block as free
      * within the memory manager's data structure.
@@ -59,6 +207,29 @@ extern "C"
      */
     void *mem_resize(void *block, size_t size);
 
+    /**
+     * Allocates several blocks of the same size at once. The pool is locked once for the
+     * whole batch and each free block taken is cut up into as many of the blocks as it holds,
+     * so the blocks mostly lie next to each other. Blocks are freed with mem_free or mem_free_batch.
+     *
+     * @param size The size of each memory block.
+     * @param count The number of blocks to allocate.
+     * @param out Where to store the pointers to the blocks, room for count of them.
+     * @return The number of blocks allocated. If it is less than count the pool ran out of space
+     *         and the error is reported once for the whole batch.
+     */
+    size_t mem_alloc_batch(size_t size, size_t count, void **out);
+
+    /**
+     * Frees several blocks at once. The pool is locked once for the whole batch and blocks
+     * that lie next to each other are merged before they are returned to the free structure.
+     * NULL pointers are skipped. Invalid blocks are skipped as well and reported once.
+     *
+     * @param blocks The pointers to the blocks to free. The array is sorted by address in place.
+     * @param count The number of pointers.
+     */
+    void mem_free_batch(void **blocks, size_t count);
+
     /**
      * Frees up the entire memory pool that was initially allocated by mem_init.
      * This function should be called to clean up the memory manager resources before
@@ -66,6 +237,392 @@ extern "C"
      */
     void mem_deinit();
 
+    /**
+     * Reports the usage of the memory pool. The figures are kept up to date as blocks
+     * are allocated and freed, so this is cheap enough to call frequently.
+     *
+     * @param stats Where to store the statistics.
+     */
+    void mem_stats(struct mem_stats *stats);
+
+    /**
+     * Returns the error of the calling thread's last failed call. Like errno,
+     * it is not cleared by calls that succeed.
+     *
+     * @return The error, or MEM_OK if no call of this thread has failed yet.
+     */
+    mem_error mem_last_error();
+
+    /**
+     * Returns a short description of an error.
+     *
+     * @param error The error to describe.
+     * @return The description.
+     */
+    const char *mem_strerror(mem_error error);
+
+    /**
+     * Sets a function to be called whenever a call on the memory pool fails. It is called without
+     * any lock held, in the failing thread. Set it before other threads use the pool, mem_init resets it.
+     *
+     * @param callback The function to call, or NULL for none.
+     * @param user_data Passed on to the callback.
+     */
+    void mem_set_error_callback(mem_error_callback callback, void *user_data);
+
+    /**
+     * Adds up the latency histograms every thread has recorded so far. Only pools
+     * initialized with MEM_INSTRUMENT record latency, for others they stay empty.
+     *
+     * @param latency Where to store the histograms.
+     */
+    void mem_latency_snapshot(mem_latency *latency);
+
+    /**
+     * Empties the latency histograms of every thread.
+     */
+    void mem_latency_reset();
+
+    /**
+     * Returns the latency below which the given percentage of the recorded latencies fall,
+     * accurate to the width of its histogram bucket.
+     *
+     * @param histogram The histogram to look at.
+     * @param percentile The percentage, from 0 to 100.
+     * @return The latency in nanoseconds, or 0 if nothing was recorded.
+     */
+    unsigned long long mem_histogram_percentile(const mem_histogram *histogram, double percentile);
+
+    /**
+     * An independent memory pool with its own lock, free lists and thread caches. The mem_*
+     * functions above work on a default arena, set up by mem_init, that every module shares.
+     */
+    typedef struct mem_arena mem_arena;
+
+    /**
+     * Creates an arena with a memory pool of the specified size, independent of mem_init
+     * and of every other arena.
+     *
+     * @param size The size of the arena's memory pool.
+     * @param options The settings to use, or NULL for the defaults.
+     * @return A pointer to the new arena, or NULL if its pool couldn't be allocated.
+     */
+    mem_arena *mem_arena_create(size_t size, const mem_options *options);
+
+    /**
+     * Allocates a block of memory from an arena, like mem_alloc.
+     *
+     * @param arena The arena to allocate from.
+     * @param size The size of the memory block to allocate.
+     * @return A pointer to the allocated memory block, or NULL if allocation fails.
+     */
+    void *mem_arena_alloc(mem_arena *arena, size_t size);
+
+    /**
+     * Allocates an aligned block of memory from an arena, like mem_alloc_aligned.
+     *
+     * @param arena The arena to allocate from.
+     * @param size The size of the memory block to allocate.
+     * @param alignment The alignment of the block, a power of two.
+     * @return A pointer to the allocated memory block, or NULL if allocation fails.
+     */
+    void *mem_arena_alloc_aligned(mem_arena *arena, size_t size, size_t alignment);
+
+    /**
+     * Allocates a zeroed block of memory from an arena, like mem_calloc.
+     *
+     * @param arena The arena to allocate from.
+     * @param count The number of elements.
+     * @param size The size of each element.
+     * @return A pointer to the allocated memory block, or NULL if allocation fails.
+     */
+    void *mem_arena_calloc(mem_arena *arena, size_t count, size_t size);
+
+    /**
+     * Frees a block of memory, like mem_free. The block must come from the same arena.
+     *
+     * @param arena The arena the block was allocated from.
+     * @param block A pointer to the memory block to free.
+     */
+    void mem_arena_free(mem_arena *arena, void *block);
+
+    /**
+     * Changes the size of a block of memory within its arena, like mem_resize.
+     *
+     * @param arena The arena the block was allocated from.
+     * @param block A pointer to the memory block to resize.
+     * @param size The new size of the memory block.
+     * @return A pointer to the resized memory block, or NULL if the resizing fails.
+     */
+    void *mem_arena_resize(mem_arena *arena, void *block, size_t size);
+
+    /**
+     * Allocates several blocks of the same size from an arena at once, like mem_alloc_batch.
+     * A sharded arena takes them from the calling thread's home shard first.
+     *
+     * @param arena The arena to allocate from.
+     * @param size The size of each memory block.
+     * @param count The number of blocks to allocate.
+     * @param out Where to store the pointers to the blocks, room for count of them.
+     * @return The number of blocks allocated.
+     */
+    size_t mem_arena_alloc_batch(mem_arena *arena, size_t size, size_t count, void **out);
+
+    /**
+     * Frees several blocks of an arena at once, like mem_free_batch.
+     *
+     * @param arena The arena the blocks were allocated from.
+     * @param blocks The pointers to the blocks to free. The array is sorted by address in place.
+     * @param count The number of pointers.
+     */
+    void mem_arena_free_batch(mem_arena *arena, void **blocks, size_t count);
+
+    /**
+     * Frees an arena's memory pool along with the arena itself. Every block
+     * allocated from the arena becomes invalid.
+     *
+     * @param arena The arena to destroy.
+     */
+    void mem_arena_destroy(mem_arena *arena);
+
+    /**
+     * Reports the usage of an arena's memory pool, like mem_stats.
+     *
+     * @param arena The arena to report on.
+     * @param stats Where to store the statistics.
+     */
+    void mem_arena_stats(mem_arena *arena, struct mem_stats *stats);
+
+    /**
+     * Sets the function to be called whenever a call on an arena fails, like mem_set_error_callback.
+     *
+     * @param arena The arena to watch.
+     * @param callback The function to call, or NULL for none.
+     * @param user_data Passed on to the callback.
+     */
+    void mem_arena_set_error_callback(mem_arena *arena, mem_error_callback callback, void *user_data);
+
+    /**
+     * Adds up the latency histograms recorded for an arena, like mem_latency_snapshot.
+     *
+     * @param arena The arena to report on.
+     * @param latency Where to store the histograms.
+     */
+    void mem_arena_latency_snapshot(mem_arena *arena, mem_latency *latency);
+
+    /**
+     * Empties the latency histograms recorded for an arena, like mem_latency_reset.
+     *
+     * @param arena The arena whose histograms to empty.
+     */
+    void mem_arena_latency_reset(mem_arena *arena);
+
+    /**
+     * A pool of equally sized objects carved out of a single block of the memory pool.
+     * Free objects form a lock-free stack, so allocating and freeing never takes a lock.
+     */
+    typedef struct mem_slab mem_slab;
+
+    /**
+     * Creates a slab that can hold 'capacity' objects of 'obj_size' bytes each. The whole
+     * slab is allocated from the memory pool at once, so mem_init must have been called.
+     *
+     * @param obj_size The size of each object in the slab.
+     * @param capacity The number of objects the slab can hold.
+     * @return A pointer to the new slab, or NULL if the pool has no room for it.
+     */
+    mem_slab *mem_slab_create(size_t obj_size, size_t capacity);
+
+    /**
+     * Allocates one object from the slab. Safe to call from several threads at once.
+     *
+     * @param slab The slab to allocate from.
+     * @return A pointer to the object, or NULL if all objects of the slab are in use.
+     */
+    void *mem_slab_alloc(mem_slab *slab);
+
+    /**
+     * Returns an object to the slab it was allocated from. Safe to call from several threads at once.
+     *
+     * @param slab The slab the object was allocated from.
+     * @param obj A pointer to the object to free.
+     */
+    void mem_slab_free(mem_slab *slab, void *obj);
+
+    /**
+     * Returns the slab and all of its objects to the memory pool.
+     *
+     * @param slab The slab to destroy.
+     */
+    void mem_slab_destroy(mem_slab *slab);
+
+    /**
+     * A region of memory carved out of a single block of the memory pool. Allocating
+     * from a region only moves a pointer forward, and all of its objects are freed at
+     * once by resetting or ending it, for data that lives exactly as long as the region.
+     */
+    typedef struct mem_region mem_region;
+
+    /**
+     * Begins a region that can hold 'capacity' bytes of objects. The whole region is
+     * allocated from the memory pool at once, so mem_init must have been called.
+     *
+     * @param capacity The number of bytes the region can hold.
+     * @return A pointer to the new region, or NULL if the pool has no room for it.
+     */
+    mem_region *mem_region_begin(size_t capacity);
+
+    /**
+     * Allocates an object from the region, 8 byte aligned. Objects are not freed one
+     * by one. Safe to call from several threads at once.
+     *
+     * @param region The region to allocate from.
+     * @param size The size of the object.
+     * @return A pointer to the object, or NULL if the region has no room left for it.
+     */
+    void *mem_region_alloc(mem_region *region, size_t size);
+
+    /**
+     * Frees every object of the region at once, in constant time. The region keeps its
+     * memory and can be allocated from again. Must not overlap with mem_region_alloc calls.
+     *
+     * @param region The region to reset.
+     */
+    void mem_region_reset(mem_region *region);
+
+    /**
+     * Returns the region and all of its objects to the memory pool.
+     *
+     * @param region The region to end.
+     */
+    void mem_region_end(mem_region *region);
+
+
+    /**
+     * A handle to a block of memory that the memory manager may move to compact the pool.
+     * The block has to be locked with mem_hlock to get at its current address, and is never
+     * moved while it is locked. 0 is never a valid handle.
+     */
+    typedef unsigned long long mem_handle;
+
+    /**
+     * Allocates a block of memory that is reached through a handle instead of a pointer,
+     * so compaction can slide it into the free space in front of it.
+     *
+     * @param size The size of the memory block to allocate.
+     * @return A handle to the allocated memory block, or 0 if allocation fails.
+     */
+    mem_handle mem_halloc(size_t size);
+
+    /**
+     * Locks a handle's block in place. Locks nest, the block stays in place until every
+     * mem_hlock call has been matched by a call to mem_hunlock.
+     *
+     * @param handle The handle of the block.
+     * @return The address of the block, valid until the handle is unlocked, or NULL if the handle is invalid.
+     */
+    void *mem_hlock(mem_handle handle);
+
+    /**
+     * Undoes one call to mem_hlock, letting compaction move the block once no locks are left.
+     *
+     * @param handle The handle of the block.
+     */
+    void mem_hunlock(mem_handle handle);
+
+    /**
+     * Frees a block allocated through a handle. The handle becomes invalid, even if it was still locked.
+     *
+     * @param handle The handle of the block to free.
+     */
+    void mem_hfree(mem_handle handle);
+
+    /**
+     * Runs one step of compaction: finds the first free block that an unlocked handle block
+     * follows, and slides that block and the handle blocks behind it down into the free space,
+     * merging the free space that collects behind them. The pool stays locked for the step only,
+     * so other threads wait at most for about 'max_bytes' to be moved.
+     *
+     * @param max_bytes The number of bytes after which the step stops moving blocks. At least one block is moved if any can be.
+     * @return The number of bytes moved, 0 if there was nothing left to compact.
+     */
+    size_t mem_compact(size_t max_bytes);
+
+    /**
+     * Starts a thread that compacts the pool in the background, step by step with mem_compact.
+     * Once there is nothing left to move it checks again every 'interval_ms' milliseconds.
+     *
+     * @param interval_ms The time between checks while there is nothing to move.
+     * @return true if the thread is running, false if it couldn't be started.
+     */
+    bool mem_compactor_start(unsigned int interval_ms);
+
+    /**
+     * Stops the background compaction thread and waits for it to finish its current step.
+     * mem_deinit stops it as well.
+     */
+    void mem_compactor_stop();
+
+    /**
+     * Handle based allocation from an arena, like mem_halloc. Sharded arenas don't support handles.
+     *
+     * @param arena The arena to allocate from.
+     * @param size The size of the memory block to allocate.
+     * @return A handle to the allocated memory block, or 0 if allocation fails.
+     */
+    mem_handle mem_arena_halloc(mem_arena *arena, size_t size);
+
+    /**
+     * Locks a handle's block of an arena in place, like mem_hlock.
+     *
+     * @param arena The arena the block was allocated from.
+     * @param handle The handle of the block.
+     * @return The address of the block, or NULL if the handle is invalid.
+     */
+    void *mem_arena_hlock(mem_arena *arena, mem_handle handle);
+
+    /**
+     * Undoes one call to mem_arena_hlock, like mem_hunlock.
+     *
+     * @param arena The arena the block was allocated from.
+     * @param handle The handle of the block.
+     */
+    void mem_arena_hunlock(mem_arena *arena, mem_handle handle);
+
+    /**
+     * Frees a block of an arena allocated through a handle, like mem_hfree.
+     *
+     * @param arena The arena the block was allocated from.
+     * @param handle The handle of the block to free.
+     */
+    void mem_arena_hfree(mem_arena *arena, mem_handle handle);
+
+    /**
+     * Runs one step of compaction on an arena, like mem_compact.
+     *
+     * @param arena The arena to compact.
+     * @param max_bytes The number of bytes after which the step stops moving blocks.
+     * @return The number of bytes moved.
+     */
+    size_t mem_arena_compact(mem_arena *arena, size_t max_bytes);
+
+    /**
+     * Starts compacting an arena in the background, like mem_compactor_start.
+     *
+     * @param arena The arena to compact.
+     * @param interval_ms The time between checks while there is nothing to move.
+     * @return true if the thread is running, false if it couldn't be started.
+     */
+    bool mem_arena_compactor_start(mem_arena *arena, unsigned int interval_ms);
+
+    /**
+     * Stops compacting an arena in the background, like mem_compactor_stop.
+     * mem_arena_destroy stops it as well.
+     *
+     * @param arena The arena being compacted.
+     */
+    void mem_arena_compactor_stop(mem_arena *arena);
+
 #ifdef __cplusplus
 }
 #endif
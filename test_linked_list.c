@@ -271,6 +271,247 @@ void test_list_delete_multithreaded(TestParams *params)
     free(thread_data);
 }
 
+void *thread_mixed_function(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    int found = 1;
+    for (int i = 0; i < data->num_nodes; i++)
+    {
+        list_insert_after(data->prev_node, data->start_value + i);
+    }
+    for (int i = 0; i < data->num_nodes; i++)
+    {
+        found = found && list_search(data->head, data->start_value + i) != NULL;
+    }
+    for (int i = 0; i < data->num_nodes; i += 2)
+    {
+        list_delete(data->head, data->start_value + i);
+    }
+    return found ? data : NULL;
+}
+
+/*
+    Every thread inserts behind its own node, searches for what it inserted and deletes half of it,
+    while the other threads do the same in other parts of the list.
+    The test passes if every thread found all of its values, and exactly the other half is left.
+*/
+void test_list_mixed_multithread(TestParams *params)
+{
+    printf_yellow("  Testing mixed inserts, searches and deletes (threads: %d, nodes: %d) ---> ", params->num_threads, params->num_nodes);
+
+    Node *head = NULL;
+    list_init(&head, sizeof(Node) * (params->num_nodes + params->num_threads));
+
+    // One node per thread to insert behind, the last one is the tail
+    Node **anchors = malloc(params->num_threads * sizeof(Node *));
+    for (int i = 0; i < params->num_threads; i++)
+    {
+        list_insert(&head, UINT16_MAX - i);
+        anchors[i] = list_search(&head, UINT16_MAX - i);
+    }
+
+    pthread_t *threads = malloc(params->num_threads * sizeof(pthread_t));
+    thread_data_t *thread_data = malloc(params->num_threads * sizeof(thread_data_t));
+    int nodes_per_thread = params->num_nodes / params->num_threads;
+    for (int i = 0; i < params->num_threads; i++)
+    {
+        thread_data[i].head = &head;
+        thread_data[i].prev_node = anchors[i];
+        thread_data[i].start_value = i * nodes_per_thread;
+        thread_data[i].num_nodes = nodes_per_thread;
+        if (pthread_create(&threads[i], NULL, thread_mixed_function, &thread_data[i]))
+        {
+            perror("Failed to create thread");
+        }
+    }
+
+    int found = 1;
+    for (int i = 0; i < params->num_threads; i++)
+    {
+        void *result;
+        pthread_join(threads[i], &result);
+        found = found && result != NULL;
+    }
+
+    // The odd values are left, each behind its thread's node, newest first
+    int in_place = 1;
+    for (int i = 0; i < params->num_threads; i++)
+    {
+        Node *walker = anchors[i]->next;
+        for (int j = nodes_per_thread - 1; j >= 0; j--)
+        {
+            if (j % 2 == 0)
+                continue;
+            in_place = in_place && walker != NULL && walker->data == thread_data[i].start_value + j;
+            walker = walker ? walker->next : NULL;
+        }
+    }
+    my_assert(found && in_place);
+    my_assert(list_count_nodes(&head) == params->num_threads + nodes_per_thread / 2 * params->num_threads);
+
+    list_cleanup(&head);
+    free(anchors);
+    free(threads);
+    free(thread_data);
+    printf_green("[PASS].\n");
+}
+
+void *thread_append_delete_function(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    for (int i = 0; i < data->num_nodes; i++)
+    {
+        list_insert(data->head, data->start_value + i);
+        list_delete(data->head, data->start_value + i);
+    }
+    return NULL;
+}
+
+// Counts the nodes from 'head' on without going through the list functions, and returns the last one
+static int walk_nodes(Node *head, Node **last)
+{
+    int count = 0;
+    *last = NULL;
+    for (Node *walker = head; walker != NULL; walker = walker->next)
+    {
+        count++;
+        *last = walker;
+    }
+    return count;
+}
+
+/*
+    Threads append to one of two lists and delete what they appended again, which mostly takes out the tail,
+    while others insert behind the head of the first list.
+    The Node** functions keep one List at a time, so changes to one list mustn't end up in the other's count or tail.
+    The test passes if both lists hold what was put into them, their counts match, and appends still land at their ends.
+*/
+void test_list_two_lists_multithread(TestParams *params)
+{
+    printf_yellow("  Testing two lists (threads: %d, nodes: %d) ---> ", params->num_threads, params->num_nodes);
+
+    int roles = 3;
+    int nodes_per_list = 256;
+    int nodes_per_thread = params->num_nodes / params->num_threads;
+    Node *heads[2] = {NULL, NULL};
+    list_init(&heads[0], sizeof(Node) * (2 * nodes_per_list + params->num_nodes + params->num_threads + 2));
+    for (int i = 0; i < 2 * nodes_per_list; i++)
+        list_insert(&heads[i / nodes_per_list], i);
+    Node *anchor = heads[0];
+
+    pthread_t *threads = malloc(params->num_threads * sizeof(pthread_t));
+    thread_data_t *thread_data = malloc(params->num_threads * sizeof(thread_data_t));
+    int inserted_after = 0;
+    for (int i = 0; i < params->num_threads; i++)
+    {
+        int role = i % roles;
+        thread_data[i] = (thread_data_t){.head = &heads[role == 1], .prev_node = anchor, .start_value = 10000 + i * nodes_per_thread, .thread_id = i, .num_nodes = nodes_per_thread};
+        if (role == 2)
+            inserted_after += nodes_per_thread;
+        if (pthread_create(&threads[i], NULL, role == 2 ? thread_insert_after_function : thread_append_delete_function, &thread_data[i]))
+        {
+            perror("Failed to create thread");
+        }
+    }
+
+    for (int i = 0; i < params->num_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    Node *last[2];
+    int count_a = walk_nodes(heads[0], &last[0]);
+    int count_b = walk_nodes(heads[1], &last[1]);
+    my_assert(count_a == nodes_per_list + inserted_after && list_count_nodes(&heads[0]) == count_a);
+    my_assert(count_b == nodes_per_list && list_count_nodes(&heads[1]) == count_b);
+    my_assert(last[0]->data == nodes_per_list - 1 && last[1]->data == 2 * nodes_per_list - 1);
+
+    // Appending lands behind the last node of each list
+    for (int i = 0; i < 2; i++)
+    {
+        list_insert(&heads[i], UINT16_MAX);
+        my_assert(last[i]->next != NULL && last[i]->next->data == UINT16_MAX && last[i]->next->next == NULL);
+    }
+
+    // Both lists are in the same pool, which goes with the first cleanup
+    list_cleanup(&heads[0]);
+    free(threads);
+    free(thread_data);
+    printf_green("[PASS].\n");
+}
+
+typedef struct
+{
+    List *list;
+    int start_value;
+    int num_nodes;
+} list_thread_data_t;
+
+void *thread_list_handle_function(void *arg)
+{
+    list_thread_data_t *data = (list_thread_data_t *)arg;
+    int found = 1;
+    for (int i = 0; i < data->num_nodes; i++)
+    {
+        list_append(data->list, data->start_value + i);
+        found = found && list_find(data->list, data->start_value + i) != NULL;
+        if (i % 2 == 0)
+            list_remove(data->list, data->start_value + i);
+    }
+    return found ? data : NULL;
+}
+
+/*
+    Threads append to one List, find what they appended and remove every other value again.
+    The test passes if every value was found, and the List's length and tail match what is left.
+*/
+void test_list_handle_multithread(TestParams *params)
+{
+    printf_yellow("  Testing List handle (threads: %d, nodes: %d) ---> ", params->num_threads, params->num_nodes);
+    Node *head = NULL;
+    list_init(&head, sizeof(Node) * params->num_nodes * 2);
+
+    List list;
+    list_handle_init(&list);
+    pthread_t *threads = malloc(params->num_threads * sizeof(pthread_t));
+    list_thread_data_t *thread_data = malloc(params->num_threads * sizeof(list_thread_data_t));
+    int nodes_per_thread = params->num_nodes / params->num_threads;
+    for (int i = 0; i < params->num_threads; i++)
+    {
+        thread_data[i] = (list_thread_data_t){.list = &list, .start_value = i * nodes_per_thread, .num_nodes = nodes_per_thread};
+        if (pthread_create(&threads[i], NULL, thread_list_handle_function, &thread_data[i]))
+        {
+            perror("Failed to create thread");
+        }
+    }
+
+    int found = 1;
+    for (int i = 0; i < params->num_threads; i++)
+    {
+        void *result;
+        pthread_join(threads[i], &result);
+        found = found && result != NULL;
+    }
+
+    size_t count = 0;
+    Node *last = NULL;
+    for (Node *walker = list.head; walker != NULL; walker = walker->next)
+    {
+        count++;
+        last = walker;
+    }
+    my_assert(found && count == (size_t)(nodes_per_thread / 2 * params->num_threads) && list_length(&list) == count);
+    // Appending still lands behind the last node
+    list_append(&list, UINT16_MAX);
+    my_assert(last->next != NULL && last->next->data == UINT16_MAX);
+
+    list_handle_cleanup(&list);
+    list_cleanup(&head);
+    free(threads);
+    free(thread_data);
+    printf_green("[PASS].\n");
+}
+
 void test_list_delete()
 {
     printf_yellow("  Testing list_delete ---> ");
@@ -505,6 +746,31 @@ void test_list_count_nodes()
     printf_green("[PASS].\n");
 }
 
+void test_list_insert_after_count()
+{
+    printf_yellow("  Testing list_count_nodes after list_insert_after ---> ");
+    Node *head = NULL;
+    list_init(&head, sizeof(Node) * 5);
+    list_insert(&head, 1);
+    list_insert(&head, 3);
+    my_assert(list_count_nodes(&head) == 2);
+
+    // Behind the tail, then in the middle of the list
+    list_insert_after(head->next, 4);
+    my_assert(list_count_nodes(&head) == 3);
+    list_insert_after(head, 2);
+    my_assert(list_count_nodes(&head) == 4);
+
+    // Appending still lands at the end, and deleting still counts down
+    list_insert(&head, 5);
+    list_delete(&head, 4);
+    my_assert(list_count_nodes(&head) == 4);
+    my_assert(head->next->next->next->data == 5 && head->next->next->next->next == NULL);
+
+    list_cleanup(&head);
+    printf_green("[PASS].\n");
+}
+
 void test_list_cleanup()
 {
     printf_yellow("  Testing list_cleanup ---> ");
@@ -519,6 +785,51 @@ void test_list_cleanup()
     printf_green("[PASS].\n");
 }
 
+void test_list_handle()
+{
+    printf_yellow("  Testing List handle ---> ");
+    Node *head = NULL;
+    list_init(&head, sizeof(Node) * 4);
+
+    List list;
+    list_handle_init(&list);
+    list_append(&list, 10);
+    list_append(&list, 20);
+    list_append(&list, 30);
+    my_assert(list_length(&list) == 3);
+    my_assert(list.head->data == 10 && list.tail->data == 30);
+
+    // Removing the tail moves it back, so the next append still lands at the end
+    list_remove(&list, 30);
+    my_assert(list.tail->data == 20);
+    list_append(&list, 40);
+    my_assert(list.head->next->next->data == 40 && list.tail->data == 40);
+    my_assert(list_find(&list, 40) == list.tail);
+    my_assert(list_find(&list, 30) == NULL);
+
+    list_remove(&list, 10);
+    list_remove(&list, 20);
+    list_remove(&list, 40);
+    my_assert(list_length(&list) == 0 && list.head == NULL && list.tail == NULL);
+
+    list_append(&list, 50);
+    list_handle_cleanup(&list);
+    my_assert(list.head == NULL && list_length(&list) == 0);
+
+    // The Node** functions keep appending at the right place around deletes
+    list_insert(&head, 1);
+    list_insert(&head, 2);
+    list_insert(&head, 3);
+    list_delete(&head, 2);
+    list_delete(&head, 3);
+    list_insert(&head, 4);
+    my_assert(list_count_nodes(&head) == 2);
+    my_assert(head->data == 1 && head->next->data == 4);
+
+    list_cleanup(&head);
+    printf_green("[PASS].\n");
+}
+
 // ********* Stress and edge cases *********
 
 void test_list_insert_loop(int count)
@@ -685,6 +996,11 @@ int main(int argc, char *argv[])
         test_list_insert_after_multithread(&(TestParams){.num_threads = base_num_threads, .num_nodes = 1024});
         test_list_insert_before_multithreaded(&(TestParams){.num_threads = base_num_threads, .num_nodes = 1024});
         test_list_delete_multithreaded(&(TestParams){.num_threads = base_num_threads, .num_nodes = 1024});
+        test_list_mixed_multithread(&(TestParams){.num_threads = base_num_threads, .num_nodes = 1024});
+        test_list_insert_after_count();
+        test_list_two_lists_multithread(&(TestParams){.num_threads = base_num_threads, .num_nodes = 1024});
+        test_list_handle();
+        test_list_handle_multithread(&(TestParams){.num_threads = base_num_threads, .num_nodes = 1024});
 
         printf("\nStress testing basic operations with various numbers of threads and nodes:\n");
         for (int i = 0; i < 9; i++)      // from 2^0 = 1 up to 2^8 = 256 threads
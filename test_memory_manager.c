@@ -851,6 +851,1088 @@ void run_concurrency_test(TestParams params)
     printf_green("[PASS].\n");
 }
 
+/*
+ * This function fills the pool exactly with blocks of mixed sizes, frees every other block and then
+ * allocates the same sizes again. The test passes if every hole is found and reused through the size class lists.
+ */
+void test_size_class_reuse()
+{
+    printf_yellow("  Testing \"size class reuse\" ---> ");
+
+    size_t sizes[] = {8, 24, 100, 300, 64, 1000, 17, 512};
+    int num_blocks = sizeof(sizes) / sizeof(sizes[0]);
+    size_t mem_size = 0;
+    for (int i = 0; i < num_blocks; i++)
+        mem_size += sizes[i];
+
+    mem_init(mem_size);
+
+    void *blocks[num_blocks];
+    for (int i = 0; i < num_blocks; i++)
+    {
+        blocks[i] = mem_alloc(sizes[i]);
+        my_assert(blocks[i] != NULL);
+    }
+
+    for (int i = 0; i < num_blocks; i += 2)
+        mem_free(blocks[i]);
+
+    // The pool is full apart from the holes, so each size has to land in its own hole again
+    for (int i = num_blocks - 2; i >= 0; i -= 2)
+    {
+        blocks[i] = mem_alloc(sizes[i]);
+        my_assert(blocks[i] != NULL);
+        memset(blocks[i], i, sizes[i]);
+    }
+
+    for (int i = 0; i < num_blocks; i += 2)
+        sanityCheck(sizes[i], blocks[i], i);
+
+    for (int i = 0; i < num_blocks; i++)
+        mem_free(blocks[i]);
+
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+void *thread_alloc_blocks(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    for (int i = 0; i < data->num_blocks; i++)
+    {
+        data->block_pointers[i] = mem_alloc(data->block_size);
+        my_assert(data->block_pointers[i] != NULL);
+    }
+    return NULL;
+}
+
+void *thread_free_blocks(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    for (int i = 0; i < data->num_blocks; i++)
+    {
+        mem_free(data->block_pointers[i]);
+    }
+    return NULL;
+}
+
+/*
+ * This function allocates blocks in one thread and frees them in others, one of them being the main thread.
+ * The test passes if the whole pool can be allocated as a single block afterwards, i.e. no block got stuck in a thread cache.
+ */
+void test_cross_thread_free()
+{
+    printf_yellow("  Testing \"free from another thread\" ---> ");
+
+    int num_blocks = 64;
+    size_t block_size = 48;
+    void *block_pointers[num_blocks];
+    pthread_t thread;
+
+    mem_init(num_blocks * block_size);
+
+    thread_data_t alloc_data = {.num_blocks = num_blocks, .block_size = block_size, .block_pointers = block_pointers};
+    pthread_create(&thread, NULL, thread_alloc_blocks, &alloc_data);
+    pthread_join(thread, NULL);
+
+    thread_data_t free_data = {.num_blocks = num_blocks / 2, .block_pointers = block_pointers};
+    pthread_create(&thread, NULL, thread_free_blocks, &free_data);
+    pthread_join(thread, NULL);
+
+    for (int i = num_blocks / 2; i < num_blocks; i++)
+        mem_free(block_pointers[i]);
+
+    void *whole_pool = mem_alloc(num_blocks * block_size);
+    my_assert(whole_pool != NULL);
+    mem_free(whole_pool);
+
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+typedef struct
+{
+    mem_slab *slab;
+    int thread_id;
+    int num_objects;
+    int iterations;
+} slab_thread_data_t;
+
+void *thread_slab_alloc_free(void *arg)
+{
+    slab_thread_data_t *data = (slab_thread_data_t *)arg;
+    char **objects = malloc(data->num_objects * sizeof(char *));
+
+    for (int n = 0; n < data->iterations; n++)
+    {
+        for (int i = 0; i < data->num_objects; i++)
+        {
+            objects[i] = mem_slab_alloc(data->slab);
+            my_assert(objects[i] != NULL);
+            memset(objects[i], data->thread_id, 24);
+        }
+
+        for (int i = 0; i < data->num_objects; i++)
+        {
+            sanityCheck(24, objects[i], data->thread_id);
+            mem_slab_free(data->slab, objects[i]);
+        }
+    }
+
+    free(objects);
+    return NULL;
+}
+
+/*
+ * This function lets several threads allocate and free objects from the same slab at once.
+ * The test passes if no object is handed out twice at the same time and the whole slab is free afterwards.
+ */
+void test_slab_multithread(TestParams params)
+{
+    printf_yellow("  Testing \"mem_slab\" (threads: %d, iterations: %d) ---> ", params.num_threads, params.iterations);
+
+    int objects_per_thread = 64;
+    int capacity = objects_per_thread * params.num_threads;
+    mem_init(64 + capacity * 24);
+
+    mem_slab *slab = mem_slab_create(24, capacity);
+    my_assert(slab != NULL);
+
+    pthread_t threads[params.num_threads];
+    slab_thread_data_t thread_data[params.num_threads];
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        thread_data[i] = (slab_thread_data_t){.slab = slab, .thread_id = i, .num_objects = objects_per_thread, .iterations = params.iterations};
+        pthread_create(&threads[i], NULL, thread_slab_alloc_free, &thread_data[i]);
+    }
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    // Every object has been returned, so exactly 'capacity' objects can be allocated again
+    for (int i = 0; i < capacity; i++)
+        my_assert(mem_slab_alloc(slab) != NULL);
+    my_assert(mem_slab_alloc(slab) == NULL);
+
+    mem_slab_destroy(slab);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+/*
+ * This function leaves holes of 100, 300 and 50 bytes in front of a large free tail and allocates 40 bytes
+ * with every placement policy. The test passes if each policy picks the hole it is defined to pick.
+ */
+void test_placement_policies()
+{
+    printf_yellow("  Testing \"placement policies\" ---> ");
+
+    mem_policy policies[] = {MEM_POLICY_SEGREGATED_FIT, MEM_POLICY_FIRST_FIT, MEM_POLICY_NEXT_FIT, MEM_POLICY_BEST_FIT};
+    size_t expected_offsets[] = {420, 0, 480, 420};
+    size_t sizes[] = {100, 10, 300, 10, 50, 10};
+
+    for (int p = 0; p < sizeof(policies) / sizeof(policies[0]); p++)
+    {
+        mem_init_ex(1000, &(mem_options){.policy = policies[p], .flags = MEM_NO_THREAD_CACHE});
+
+        char *blocks[6];
+        for (int i = 0; i < 6; i++)
+        {
+            blocks[i] = mem_alloc(sizes[i]);
+            my_assert(blocks[i] != NULL);
+        }
+        mem_free(blocks[0]);
+        mem_free(blocks[2]);
+        mem_free(blocks[4]);
+
+        char *block = mem_alloc(40);
+        my_assert(block == blocks[0] + expected_offsets[p]);
+
+        mem_deinit();
+    }
+
+    printf_green("[PASS].\n");
+}
+
+/*
+ * This function mixes odd sized allocations with aligned ones, and then checks the default minimum alignment mode.
+ * The test passes if every block is aligned as requested and no padding is lost once everything is freed.
+ */
+void test_aligned_alloc()
+{
+    printf_yellow("  Testing \"mem_alloc_aligned\" ---> ");
+
+    size_t mem_size = 4096;
+    mem_init(mem_size);
+
+    size_t alignments[] = {16, 32, 64, 8, 128};
+    void *blocks[10];
+    for (int i = 0; i < 5; i++)
+    {
+        blocks[2 * i] = mem_alloc(3); // Knocks the next free address out of alignment
+        blocks[2 * i + 1] = mem_alloc_aligned(100, alignments[i]);
+        my_assert(blocks[2 * i + 1] != NULL);
+        my_assert((size_t)blocks[2 * i + 1] % alignments[i] == 0);
+    }
+    my_assert(mem_alloc_aligned(100, 24) == NULL); // Not a power of two
+
+    for (int i = 0; i < 10; i++)
+        mem_free(blocks[i]);
+
+    // The padding in front of the aligned blocks went back to the pool as well
+    void *whole_pool = mem_alloc(mem_size);
+    my_assert(whole_pool != NULL);
+    mem_free(whole_pool);
+
+    // A block without room for padding still does if it happens to start aligned
+    whole_pool = mem_alloc_aligned(mem_size, 16);
+    my_assert(whole_pool != NULL && (size_t)whole_pool % 16 == 0);
+    mem_free(whole_pool);
+    mem_deinit();
+
+    // With a minimum alignment every block is aligned and sized in multiples of it
+    mem_init_ex(mem_size, &(mem_options){.min_alignment = 64});
+    for (int i = 0; i < 10; i++)
+    {
+        blocks[i] = mem_alloc(1 + i * 7);
+        my_assert(blocks[i] != NULL);
+        my_assert((size_t)blocks[i] % 64 == 0);
+    }
+    for (int i = 0; i < 10; i++)
+        mem_free(blocks[i]);
+    mem_deinit();
+
+    printf_green("[PASS].\n");
+}
+
+/*
+ * This function uses pools mapped with mmap, with and without huge pages.
+ * The test passes if a large freed block has its pages returned to the OS, which makes them read as zero again.
+ */
+void test_mmap_pool()
+{
+    printf_yellow("  Testing \"mmap backed pools\" ---> ");
+
+    size_t mem_size = 16 << 20;
+    size_t block_size = 8 << 20;
+    unsigned int flags[] = {MEM_MMAP, MEM_HUGE_PAGES};
+
+    for (int f = 0; f < 2; f++)
+    {
+        mem_init_ex(mem_size, &(mem_options){.flags = flags[f] | MEM_NO_THREAD_CACHE});
+
+        char *block = mem_alloc(block_size);
+        my_assert(block != NULL);
+        memset(block, 0xAB, block_size);
+        mem_free(block);
+
+        // The block merged back into one large free block, whose pages were released
+        block = mem_alloc(block_size);
+        my_assert(block != NULL);
+        sanityCheck(block_size / 2, block + block_size / 4, 0);
+        mem_free(block);
+
+        mem_deinit();
+    }
+
+    printf_green("[PASS].\n");
+}
+
+/*
+ * This function grows and shrinks blocks next to free space, and grows one that has to take up both of its free neighbours.
+ * The test passes if the blocks stay where they can, keep their data, and give back exactly the space they no longer need.
+ */
+void test_resize_in_place()
+{
+    printf_yellow("  Testing \"mem_resize in place\" ---> ");
+
+    mem_init_ex(1000, &(mem_options){.flags = MEM_NO_THREAD_CACHE});
+
+    // Growing into the free tail only takes what is needed, shrinking gives the rest back
+    char *first = mem_alloc(100);
+    char *block = mem_alloc(100);
+    memset(block, 0x11, 100);
+    my_assert(mem_resize(block, 300) == block);
+    my_assert(mem_alloc(100) == block + 300);
+    my_assert(mem_resize(block, 50) == block);
+    sanityCheck(50, block, 0x11);
+    my_assert(mem_alloc(250) == block + 50);
+    mem_free(first);
+    mem_deinit();
+
+    // A block between two free blocks grows into both of them, moving to the front one
+    mem_init_ex(1000, &(mem_options){.flags = MEM_NO_THREAD_CACHE});
+    char *blocks[4];
+    for (int i = 0; i < 4; i++)
+        blocks[i] = mem_alloc(100);
+    memset(blocks[1], 0x22, 100);
+    mem_free(blocks[0]);
+    mem_free(blocks[2]);
+
+    block = mem_resize(blocks[1], 280);
+    my_assert(block == blocks[0]);
+    sanityCheck(100, block, 0x22);
+    my_assert(mem_alloc(20) == blocks[0] + 280);
+
+    // With no room around it the block moves, taking its data along
+    block = mem_resize(block, 500);
+    my_assert(block == blocks[0] + 400);
+    sanityCheck(100, block, 0x22);
+    my_assert(mem_alloc(280) == blocks[0]);
+
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+/*
+ * This function leaves a hole in front of the free tail of the pool, and makes an allocation, a free and a resize fail.
+ * The test passes if mem_stats reports the pool's layout and counts every operation, including those served by a thread cache.
+ */
+void test_mem_stats()
+{
+    printf_yellow("  Testing \"mem_stats\" ---> ");
+
+    struct mem_stats stats;
+    mem_init_ex(1000, &(mem_options){.flags = MEM_NO_THREAD_CACHE});
+
+    char *a = mem_alloc(100);
+    char *b = mem_alloc(200);
+    my_assert(mem_alloc(100) != NULL);
+    mem_free(a);
+
+    mem_stats(&stats);
+    my_assert(stats.bytes_used == 300 && stats.bytes_free == 700);
+    my_assert(stats.largest_free_block == 600 && stats.free_block_count == 2);
+    my_assert(stats.fragmentation > 0.142 && stats.fragmentation < 0.143);
+
+    my_assert(mem_alloc(2000) == NULL);
+    mem_free(a);
+    my_assert(mem_resize(b, 250) == a);
+    my_assert(mem_resize(b, 10) == NULL);
+
+    mem_stats(&stats);
+    my_assert(stats.allocs == 3 && stats.frees == 1 && stats.resizes == 1);
+    my_assert(stats.alloc_failures == 1 && stats.free_failures == 1 && stats.resize_failures == 1);
+    my_assert(stats.bytes_used == 350 && stats.free_block_count == 2);
+    mem_deinit();
+
+    // Taking the largest free block of a size class leaves the next largest in it to be reported
+    mem_init_ex(1000, &(mem_options){.flags = MEM_NO_THREAD_CACHE});
+    char *blocks[5];
+    for (int i = 0; i < 5; i++)
+        blocks[i] = mem_alloc(150);
+    mem_free(blocks[1]);
+    mem_free(blocks[3]);
+    mem_stats(&stats);
+    my_assert(stats.largest_free_block == 250);
+    my_assert(mem_alloc(250) != NULL);
+    mem_stats(&stats);
+    my_assert(stats.largest_free_block == 150 && stats.free_block_count == 2);
+    // Another block of the same size is still there
+    my_assert(mem_alloc(150) != NULL);
+    mem_stats(&stats);
+    my_assert(stats.largest_free_block == 150 && stats.free_block_count == 1);
+    mem_deinit();
+
+    // The second allocation and free never leave the thread cache
+    mem_init(1000);
+    mem_free(mem_alloc(50));
+    mem_free(mem_alloc(50));
+
+    mem_stats(&stats);
+    my_assert(stats.allocs == 2 && stats.frees == 2);
+    my_assert(stats.bytes_used == 50 && stats.bytes_free == 950);
+    mem_deinit();
+
+    printf_green("[PASS].\n");
+}
+
+void *thread_alloc_free_pairs(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    for (int i = 0; i < data->num_blocks; i++)
+    {
+        void *block = mem_alloc(data->block_size);
+        my_assert(block != NULL);
+        mem_free(block);
+    }
+    return NULL;
+}
+
+/*
+ * This function lets several threads allocate and free blocks in an instrumented pool, then resizes a block from the main thread.
+ * The test passes if every call shows up in the histograms of its operation, percentiles grow with the percentage, and a reset empties them.
+ */
+void test_latency_histograms(TestParams params)
+{
+    printf_yellow("  Testing \"latency histograms\" (threads: %d) ---> ", params.num_threads);
+
+    int pairs_per_thread = 1000;
+    mem_init_ex(64 * params.num_threads, &(mem_options){.flags = MEM_INSTRUMENT | MEM_NO_THREAD_CACHE});
+
+    pthread_t threads[params.num_threads];
+    thread_data_t thread_data[params.num_threads];
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        thread_data[i] = (thread_data_t){.num_blocks = pairs_per_thread, .block_size = 64};
+        pthread_create(&threads[i], NULL, thread_alloc_free_pairs, &thread_data[i]);
+    }
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    void *block = mem_alloc(16);
+    block = mem_resize(block, 32);
+    my_assert(block != NULL);
+    mem_free(block);
+
+    // The threads have exited, their histograms must still be included
+    mem_latency *latency = malloc(sizeof(mem_latency));
+    mem_latency_snapshot(latency);
+    unsigned long long pairs = (unsigned long long)pairs_per_thread * params.num_threads + 1;
+    for (int phase = 0; phase < MEM_PHASE_COUNT; phase++)
+    {
+        my_assert(latency->histograms[MEM_OP_ALLOC][phase].count == pairs);
+        my_assert(latency->histograms[MEM_OP_FREE][phase].count == pairs);
+        my_assert(latency->histograms[MEM_OP_RESIZE][phase].count == 1);
+    }
+
+    mem_histogram *alloc_total = &latency->histograms[MEM_OP_ALLOC][MEM_PHASE_TOTAL];
+    my_assert(mem_histogram_percentile(alloc_total, 50) <= mem_histogram_percentile(alloc_total, 99));
+    my_assert(mem_histogram_percentile(alloc_total, 99) <= alloc_total->max);
+    my_assert(mem_histogram_percentile(alloc_total, 100) == alloc_total->max);
+    my_assert(alloc_total->sum >= latency->histograms[MEM_OP_ALLOC][MEM_PHASE_SEARCH].sum);
+
+    mem_latency_reset();
+    mem_latency_snapshot(latency);
+    my_assert(latency->histograms[MEM_OP_ALLOC][MEM_PHASE_TOTAL].count == 0);
+    my_assert(latency->histograms[MEM_OP_FREE][MEM_PHASE_LOCK_WAIT].max == 0);
+
+    free(latency);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+void *thread_alloc_check_free(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    char *blocks[data->num_blocks];
+    size_t sizes[data->num_blocks];
+
+    for (int n = 0; n < data->iterations; n++)
+    {
+        for (int i = 0; i < data->num_blocks; i++)
+        {
+            sizes[i] = 1 + rand() % data->max_block_size;
+            blocks[i] = mem_alloc(sizes[i]);
+            my_assert(blocks[i] != NULL);
+            memset(blocks[i], data->thread_id, sizes[i]);
+        }
+
+        // Free every other block first, so the other threads' searches run into holes
+        for (int i = 0; i < data->num_blocks; i += 2)
+        {
+            sanityCheck(sizes[i], blocks[i], data->thread_id);
+            mem_free(blocks[i]);
+        }
+        for (int i = 1; i < data->num_blocks; i += 2)
+        {
+            sanityCheck(sizes[i], blocks[i], data->thread_id);
+            mem_free(blocks[i]);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * This function lets several threads allocate and free random sized blocks under the policies whose searches run under the shared lock.
+ * The test passes if no block is handed out twice, i.e. every thread finds its own data, and the pool is whole again afterwards.
+ */
+void test_shared_search_multithread(TestParams params)
+{
+    printf_yellow("  Testing \"searches under the shared lock\" (threads: %d, iterations: %d) ---> ", params.num_threads, params.iterations);
+
+    mem_policy policies[] = {MEM_POLICY_FIRST_FIT, MEM_POLICY_NEXT_FIT};
+    int blocks_per_thread = 32;
+    int max_block_size = 128;
+    // Twice the space the threads can use at once, so fragmentation can't make an allocation fail
+    size_t mem_size = 2 * (size_t)params.num_threads * blocks_per_thread * max_block_size;
+
+    for (int p = 0; p < 2; p++)
+    {
+        mem_init_ex(mem_size, &(mem_options){.policy = policies[p], .flags = MEM_NO_THREAD_CACHE});
+
+        pthread_t threads[params.num_threads];
+        thread_data_t thread_data[params.num_threads];
+        for (int i = 0; i < params.num_threads; i++)
+        {
+            thread_data[i] = (thread_data_t){.thread_id = i + 1, .num_blocks = blocks_per_thread, .max_block_size = max_block_size, .iterations = params.iterations};
+            pthread_create(&threads[i], NULL, thread_alloc_check_free, &thread_data[i]);
+        }
+
+        for (int i = 0; i < params.num_threads; i++)
+        {
+            pthread_join(threads[i], NULL);
+        }
+
+        void *whole_pool = mem_alloc(mem_size);
+        my_assert(whole_pool != NULL);
+        mem_free(whole_pool);
+        mem_deinit();
+    }
+
+    printf_green("[PASS].\n");
+}
+
+/*
+ * This function lets several threads fill a pool split into as many shards, then frees every block from the main thread.
+ * The test passes if the threads can use the whole pool, frees find their shards, and a block too large for its shard moves to another one.
+ */
+void test_sharded_pool(TestParams params)
+{
+    printf_yellow("  Testing \"sharded pool\" (threads: %d) ---> ", params.num_threads);
+
+    int blocks_per_thread = 64;
+    size_t block_size = 32;
+    int total_blocks = blocks_per_thread * params.num_threads;
+    size_t shard_size = blocks_per_thread * block_size;
+    void *block_pointers[total_blocks];
+
+    mem_init_ex(total_blocks * block_size, &(mem_options){.shards = params.num_threads});
+
+    // Allocating every byte of the pool needs stealing from other shards whenever two threads share one
+    pthread_t threads[params.num_threads];
+    thread_data_t thread_data[params.num_threads];
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        thread_data[i] = (thread_data_t){.num_blocks = blocks_per_thread, .block_size = block_size, .block_pointers = &block_pointers[i * blocks_per_thread]};
+        pthread_create(&threads[i], NULL, thread_alloc_blocks, &thread_data[i]);
+    }
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    my_assert(mem_alloc(1) == NULL);
+
+    for (int i = 0; i < total_blocks; i++)
+        mem_free(block_pointers[i]);
+
+    // Every shard is whole again, but a block can't span two of them
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        block_pointers[i] = mem_alloc(shard_size);
+        my_assert(block_pointers[i] != NULL);
+    }
+    for (int i = 0; i < params.num_threads; i++)
+        mem_free(block_pointers[i]);
+    my_assert(mem_alloc(shard_size + 1) == NULL);
+
+    struct mem_stats stats;
+    mem_stats(&stats);
+    my_assert(stats.bytes_used == 0 && stats.free_block_count == params.num_threads);
+    my_assert(stats.allocs == total_blocks + params.num_threads && stats.alloc_failures == 2);
+    mem_deinit();
+
+    // A block that outgrows its full shard moves to the other one
+    mem_init_ex(2000, &(mem_options){.shards = 2, .flags = MEM_NO_THREAD_CACHE});
+    char *block = mem_alloc(900);
+    my_assert(mem_alloc(100) != NULL);
+    memset(block, 0x33, 900);
+
+    char *moved = mem_resize(block, 950);
+    my_assert(moved != NULL && moved != block);
+    sanityCheck(900, moved, 0x33);
+
+    mem_stats(&stats);
+    my_assert(stats.resizes == 1 && stats.resize_failures == 0 && stats.bytes_used == 1050);
+    mem_deinit();
+
+    printf_green("[PASS].\n");
+}
+
+/*
+    Allocates and frees blocks in batches, in a plain and in a sharded pool.
+    The test passes if a batch is carved out of the pool in one piece, a batch
+    that doesn't fit is allocated as far as it goes, freeing a batch in any order
+    merges the pool back into one free block, and invalid pointers in a batch are
+    reported without keeping the other blocks from being freed.
+*/
+void test_batch_alloc_free()
+{
+    printf_yellow("  Testing \"batch allocation and free\" ---> ");
+
+    void *blocks[20];
+    struct mem_stats stats;
+
+    mem_init(1000);
+    my_assert(mem_alloc_batch(100, 10, blocks) == 10);
+    my_assert(mem_alloc(1) == NULL);
+    for (int i = 0; i < 10; i++)
+    {
+        if (i > 0)
+            my_assert((char *)blocks[i] == (char *)blocks[i - 1] + 100);
+        memset(blocks[i], 0x40 + i, 100);
+    }
+    for (int i = 0; i < 10; i++)
+        sanityCheck(100, blocks[i], 0x40 + i);
+
+    // Out of order, with a NULL that is skipped
+    void *tmp = blocks[0];
+    blocks[0] = blocks[7];
+    blocks[7] = tmp;
+    blocks[10] = NULL;
+    mem_free_batch(blocks, 11);
+
+    mem_stats(&stats);
+    my_assert(stats.bytes_used == 0 && stats.free_block_count == 1);
+    my_assert(stats.allocs == 10 && stats.frees == 10 && stats.alloc_failures == 1);
+
+    // Only part of a batch fits
+    void *block = mem_alloc(300);
+    my_assert(mem_alloc_batch(100, 10, blocks) == 7);
+    my_assert(mem_last_error() == MEM_ERROR_NO_SPACE);
+
+    // The block freed twice is skipped, the others are freed
+    blocks[7] = blocks[3];
+    blocks[8] = block;
+    mem_free_batch(blocks, 9);
+    my_assert(mem_last_error() == MEM_ERROR_INVALID_BLOCK);
+
+    mem_stats(&stats);
+    my_assert(stats.bytes_used == 0 && stats.free_block_count == 1 && stats.free_failures == 1);
+    mem_deinit();
+
+    // A batch too large for the home shard takes the rest from the other one
+    mem_init_ex(2000, &(mem_options){.shards = 2});
+    my_assert(mem_alloc_batch(100, 20, blocks) == 20);
+    my_assert(mem_alloc(1) == NULL);
+    mem_free_batch(blocks, 20);
+
+    mem_stats(&stats);
+    my_assert(stats.bytes_used == 0 && stats.free_block_count == 2);
+    mem_deinit();
+
+    printf_green("[PASS].\n");
+}
+
+/*
+    Allocates objects from a region, resets it and ends it.
+    The test passes if objects are handed out back to back and 8 byte aligned,
+    allocation fails once the region is full, a reset makes the whole region
+    available again, and ending the region returns all of it to the pool.
+*/
+void test_region()
+{
+    printf_yellow("  Testing \"mem_region\" ---> ");
+
+    mem_init(1000);
+    mem_region *region = mem_region_begin(400);
+    my_assert(region != NULL);
+    my_assert(mem_region_begin(1000) == NULL);
+
+    char *first = mem_region_alloc(region, 10);
+    char *second = mem_region_alloc(region, 100);
+    my_assert(first != NULL && ((size_t)first & 7) == 0);
+    my_assert(second == first + 16);
+    memset(first, 0x21, 10);
+    memset(second, 0x22, 100);
+    sanityCheck(10, first, 0x21);
+
+    my_assert(mem_region_alloc(region, 280) == first + 120);
+    my_assert(mem_region_alloc(region, 1) == NULL);
+
+    mem_region_reset(region);
+    my_assert(mem_region_alloc(region, 400) == first);
+    my_assert(mem_region_alloc(region, 1) == NULL);
+
+    mem_region_end(region);
+    my_assert(mem_alloc(1000) != NULL);
+    mem_deinit();
+
+    printf_green("[PASS].\n");
+}
+
+/*
+    Allocates zeroed blocks from fresh, released and reused parts of a mapped pool, and from a thread cache.
+    The test passes if every block reads as zero, the fresh pages of a new pool are not touched
+    to clear them, and an allocation whose size overflows fails.
+*/
+void test_calloc()
+{
+    printf_yellow("  Testing \"mem_calloc\" ---> ");
+
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t block_size = 2 << 20;
+    unsigned char resident[(2 << 20) / 4096 + 1];
+
+    mem_init_ex(4 << 20, &(mem_options){.flags = MEM_MMAP | MEM_NO_THREAD_CACHE});
+
+    // Fresh pages are left alone, so none of them is committed yet
+    char *block = mem_calloc(block_size / 1024, 1024);
+    my_assert(block != NULL && ((size_t)block & (page_size - 1)) == 0);
+    my_assert(mincore(block, block_size, resident) == 0);
+    int resident_pages = 0;
+    for (size_t i = 0; i < block_size / page_size; i++)
+        resident_pages += resident[i] & 1;
+    my_assert(resident_pages == 0);
+    sanityCheck(block_size, block, 0);
+
+    // The pages are released once the block is freed, but the ones written to in front of the next block are not
+    memset(block, 0xEE, block_size);
+    mem_free(block);
+    char *small = mem_alloc(100);
+    memset(small, 0xCD, 100);
+    block = mem_calloc(1, block_size);
+    my_assert(block == small + 100);
+    sanityCheck(block_size, block, 0);
+
+    // A small block that was used before is cleared in full
+    mem_free(small);
+    small = mem_calloc(10, 10);
+    sanityCheck(100, small, 0);
+    mem_deinit();
+
+    // Blocks taken from a thread cache are cleared as well
+    mem_init(1000);
+    small = mem_alloc(100);
+    memset(small, 0x55, 100);
+    mem_free(small);
+    my_assert(mem_calloc(25, 4) == small);
+    sanityCheck(100, small, 0);
+
+    my_assert(mem_calloc((size_t)-1, 2) == NULL);
+    my_assert(mem_last_error() == MEM_ERROR_NO_SPACE);
+    mem_deinit();
+
+    printf_green("[PASS].\n");
+}
+
+/*
+    Fragments a pool with handle blocks, then compacts it step by step and in the background.
+    The test passes if compaction slides unlocked blocks together so a large block fits again,
+    leaves locked blocks where they are, keeps the data of every block, and rejects handle
+    blocks being freed through their pointer or twice through their handle.
+*/
+void test_handles_compaction()
+{
+    printf_yellow("  Testing \"handles and compaction\" ---> ");
+
+    mem_handle handles[10];
+    struct mem_stats stats;
+
+    mem_init_ex(1000, &(mem_options){.flags = MEM_NO_THREAD_CACHE});
+    for (int i = 0; i < 10; i++)
+    {
+        handles[i] = mem_halloc(100);
+        my_assert(handles[i] != 0);
+        memset(mem_hlock(handles[i]), 0x60 + i, 100);
+        mem_hunlock(handles[i]);
+    }
+
+    // Every other block freed leaves holes too small for 200 bytes
+    char *pinned = mem_hlock(handles[7]);
+    for (int i = 0; i < 10; i += 2)
+        mem_hfree(handles[i]);
+    my_assert(mem_alloc(200) == NULL);
+
+    // Blocks slide down up to the locked one, which stays where it was
+    my_assert(mem_compact((size_t)-1) == 300);
+    my_assert(mem_hlock(handles[7]) == pinned);
+    mem_hunlock(handles[7]);
+    mem_stats(&stats);
+    my_assert(stats.largest_free_block == 400 && stats.free_block_count == 2);
+
+    mem_hunlock(handles[7]);
+    my_assert(mem_compact((size_t)-1) == 200);
+    my_assert(mem_compact((size_t)-1) == 0);
+    for (int i = 1; i < 10; i += 2)
+    {
+        char *block = mem_hlock(handles[i]);
+        my_assert(block == (char *)mem_hlock(handles[1]) + (i / 2) * 100);
+        sanityCheck(100, block, 0x60 + i);
+        mem_hunlock(handles[i]);
+        mem_hunlock(handles[1]);
+    }
+    my_assert(mem_alloc(500) != NULL);
+
+    // Handle blocks are only freed through a valid handle
+    mem_free(mem_hlock(handles[1]));
+    my_assert(mem_last_error() == MEM_ERROR_INVALID_BLOCK);
+    mem_hunlock(handles[1]);
+    mem_hfree(handles[0]);
+    my_assert(mem_last_error() == MEM_ERROR_INVALID_BLOCK);
+    my_assert(mem_hlock(handles[0]) == NULL);
+    mem_deinit();
+
+    // The background compactor gets there on its own
+    mem_init(1000);
+    for (int i = 0; i < 10; i++)
+    {
+        handles[i] = mem_halloc(100);
+        memset(mem_hlock(handles[i]), 0x60 + i, 100);
+        mem_hunlock(handles[i]);
+    }
+    for (int i = 0; i < 10; i += 2)
+        mem_hfree(handles[i]);
+
+    my_assert(mem_compactor_start(1));
+    for (int tries = 0; tries < 1000; tries++)
+    {
+        mem_stats(&stats);
+        if (stats.largest_free_block == 500)
+            break;
+        usleep(1000);
+    }
+    mem_compactor_stop();
+    my_assert(stats.largest_free_block == 500);
+    for (int i = 1; i < 10; i += 2)
+    {
+        sanityCheck(100, mem_hlock(handles[i]), 0x60 + i);
+        mem_hunlock(handles[i]);
+    }
+    mem_deinit();
+
+    printf_green("[PASS].\n");
+}
+
+typedef struct
+{
+    int calls;
+    mem_error error;
+    void *block;
+} error_log_t;
+
+void log_error(mem_error error, void *block, size_t size, void *user_data)
+{
+    error_log_t *log = (error_log_t *)user_data;
+    log->calls++;
+    log->error = error;
+    log->block = block;
+
+    // The pool lock is not held, so the pool can be used from here
+    mem_free(mem_alloc(1));
+}
+
+/*
+ * This function makes an allocation, a free and an aligned allocation fail with an error callback set.
+ * The test passes if every failure reaches the callback and mem_last_error with the right error code.
+ */
+void test_error_reporting()
+{
+    printf_yellow("  Testing \"error reporting\" ---> ");
+
+    error_log_t log = {0};
+    mem_init(100);
+    mem_set_error_callback(log_error, &log);
+
+    char *block = mem_alloc(50);
+    my_assert(block != NULL && log.calls == 0);
+
+    my_assert(mem_alloc(100) == NULL);
+    my_assert(log.calls == 1 && log.error == MEM_ERROR_NO_SPACE);
+    my_assert(mem_last_error() == MEM_ERROR_NO_SPACE);
+
+    mem_free(block + 1);
+    my_assert(log.calls == 2 && log.error == MEM_ERROR_INVALID_BLOCK && log.block == block + 1);
+    my_assert(mem_last_error() == MEM_ERROR_INVALID_BLOCK);
+
+    my_assert(mem_alloc_aligned(8, 3) == NULL);
+    my_assert(log.calls == 3 && mem_last_error() == MEM_ERROR_INVALID_ARGUMENT);
+
+    // Successful calls leave the last error alone
+    mem_free(block);
+    my_assert(log.calls == 3 && mem_last_error() == MEM_ERROR_INVALID_ARGUMENT);
+    my_assert(strcmp(mem_strerror(MEM_ERROR_NO_SPACE), "no space in memory") == 0);
+
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+typedef struct
+{
+    int thread_id;
+    int num_blocks;
+    size_t block_size;
+    unsigned int flags;
+} arena_thread_data_t;
+
+void *thread_arena_alloc_free(void *arg)
+{
+    arena_thread_data_t *data = (arena_thread_data_t *)arg;
+    size_t arena_size = data->num_blocks * data->block_size;
+    char *blocks[data->num_blocks];
+
+    mem_arena *arena = mem_arena_create(arena_size, &(mem_options){.flags = data->flags});
+    my_assert(arena != NULL);
+
+    // Fill the arena to the last byte, other arenas and the default pool must not get in the way
+    for (int i = 0; i < data->num_blocks; i++)
+    {
+        blocks[i] = mem_arena_alloc(arena, data->block_size);
+        my_assert(blocks[i] != NULL);
+        memset(blocks[i], data->thread_id, data->block_size);
+    }
+    my_assert(mem_arena_alloc(arena, 1) == NULL);
+
+    // Growing the first block into the second one's space keeps its data. With a thread cache
+    // the freed block would stay in the cache instead of being merged, so only do this without one
+    int first_kept = 0;
+    if (data->flags & MEM_NO_THREAD_CACHE)
+    {
+        mem_arena_free(arena, blocks[1]);
+        blocks[1] = mem_arena_resize(arena, blocks[0], 2 * data->block_size);
+        my_assert(blocks[1] == blocks[0]);
+        first_kept = 1;
+    }
+
+    for (int i = first_kept; i < data->num_blocks; i++)
+    {
+        sanityCheck(data->block_size, blocks[i], data->thread_id);
+        mem_arena_free(arena, blocks[i]);
+    }
+
+    void *whole_arena = mem_arena_alloc(arena, arena_size);
+    my_assert(whole_arena != NULL);
+    mem_arena_free(arena, whole_arena);
+
+    mem_arena_destroy(arena);
+    return NULL;
+}
+
+/*
+ * This function lets every thread create, fill up and destroy an arena of its own, every other one without a thread cache,
+ * while the default pool holds a block.
+ * The test passes if every arena can be filled exactly and the default pool is left untouched.
+ */
+void test_arena_multithread(TestParams params)
+{
+    printf_yellow("  Testing \"mem_arena\" (threads: %d) ---> ", params.num_threads);
+
+    mem_init(100);
+    char *block = mem_alloc(100);
+    my_assert(block != NULL);
+    memset(block, 0x5A, 100);
+
+    pthread_t threads[params.num_threads];
+    arena_thread_data_t thread_data[params.num_threads];
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        thread_data[i] = (arena_thread_data_t){.thread_id = i + 1, .num_blocks = 64, .block_size = 32, .flags = i % 2 ? MEM_NO_THREAD_CACHE : 0};
+        pthread_create(&threads[i], NULL, thread_arena_alloc_free, &thread_data[i]);
+    }
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    sanityCheck(100, block, 0x5A);
+    mem_free(block);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+/*
+ * This function benchmarks the placement policies in a pool with 'live_blocks' allocated blocks and about as many free holes between them.
+ * It times allocating and freeing blocks of random size, which should stay flat for best fit and segregated fit as the pool fills up.
+ */
+void benchmark_placement_policies(int live_blocks)
+{
+    mem_policy policies[] = {MEM_POLICY_SEGREGATED_FIT, MEM_POLICY_FIRST_FIT, MEM_POLICY_NEXT_FIT, MEM_POLICY_BEST_FIT};
+    char *policy_names[] = {"segregated fit", "first fit", "next fit", "best fit"};
+    int operations = 10000;
+    size_t max_block_size = 256;
+
+    void **blocks = malloc(2 * live_blocks * sizeof(void *));
+    size_t *sizes = malloc(operations * sizeof(size_t));
+    for (int i = 0; i < operations; i++)
+        sizes[i] = 1 + rand() % max_block_size;
+
+    for (int p = 0; p < sizeof(policies) / sizeof(policies[0]); p++)
+    {
+        // Filling the pool takes quadratic time under first fit, as every allocation rescans all earlier blocks
+        if (policies[p] == MEM_POLICY_FIRST_FIT && live_blocks > 10000)
+        {
+            printf_yellow("  %-15s live blocks: %7d, skipped\n", policy_names[p], live_blocks);
+            continue;
+        }
+
+        mem_init_ex(2 * live_blocks * max_block_size + max_block_size * operations, &(mem_options){.policy = policies[p], .flags = MEM_NO_THREAD_CACHE});
+
+        // Fill the pool and punch a hole next to every live block
+        for (int i = 0; i < 2 * live_blocks; i++)
+            blocks[i] = mem_alloc(1 + rand() % max_block_size);
+        for (int i = 0; i < 2 * live_blocks; i += 2)
+            mem_free(blocks[i]);
+
+        struct timeval start_time, end_time;
+        gettimeofday(&start_time, NULL);
+        for (int i = 0; i < operations; i++)
+        {
+            void *block = mem_alloc(sizes[i]);
+            my_assert(block != NULL);
+            mem_free(block);
+        }
+        gettimeofday(&end_time, NULL);
+
+        long micros = (end_time.tv_sec - start_time.tv_sec) * 1000000 + end_time.tv_usec - start_time.tv_usec;
+        printf_yellow("  %-15s live blocks: %7d, alloc+free: %8.1f ns\n", policy_names[p], live_blocks, micros * 1000.0 / operations);
+
+        mem_deinit();
+    }
+
+    free(sizes);
+    free(blocks);
+}
+
+// Allocating into holes of one size takes a block of the largest size of its class every time,
+// which mustn't cost a search through all the others
+void benchmark_equal_size_holes(int live_blocks)
+{
+    mem_policy policies[] = {MEM_POLICY_SEGREGATED_FIT, MEM_POLICY_BEST_FIT};
+    char *policy_names[] = {"segregated fit", "best fit"};
+    int operations = 10000;
+    size_t block_size = 200;
+
+    void **blocks = malloc(2 * live_blocks * sizeof(void *));
+    for (int p = 0; p < sizeof(policies) / sizeof(policies[0]); p++)
+    {
+        mem_init_ex(2 * live_blocks * block_size, &(mem_options){.policy = policies[p], .flags = MEM_NO_THREAD_CACHE});
+
+        // Fill the pool and punch a hole of the same size next to every live block
+        for (int i = 0; i < 2 * live_blocks; i++)
+            blocks[i] = mem_alloc(block_size);
+        for (int i = 0; i < 2 * live_blocks; i += 2)
+            mem_free(blocks[i]);
+
+        struct timeval start_time, end_time;
+        gettimeofday(&start_time, NULL);
+        for (int i = 0; i < operations; i++)
+        {
+            void *block = mem_alloc(block_size);
+            my_assert(block != NULL);
+            mem_free(block);
+        }
+        gettimeofday(&end_time, NULL);
+
+        struct mem_stats stats;
+        mem_stats(&stats);
+        my_assert(stats.largest_free_block == block_size && stats.free_block_count == live_blocks);
+
+        long micros = (end_time.tv_sec - start_time.tv_sec) * 1000000 + end_time.tv_usec - start_time.tv_usec;
+        printf_yellow("  %-15s equal holes: %7d, alloc+free: %8.1f ns\n", policy_names[p], live_blocks, micros * 1000.0 / operations);
+
+        mem_deinit();
+    }
+
+    free(blocks);
+}
+
 /* repeated from A1, as there were solutions that has issues */
 
 void test_looking_for_out_of_bounds()
@@ -902,7 +1984,8 @@ int main(int argc, char *argv[])
         printf("  0. tests various functions with a base number of threads\n");
         printf("  1. tests various functions across variious configurations (number of threads, memory sizes,  iterations)\n");
         printf("  2. stress tests various functions with various configurations. This may take some time (especially if simulate_work flag is set to true.\n");
-        printf("  3. test_looking_for_out_of_bounds, needs LD_PRELOAD=./libmymalloc.so .\n\n");
+        printf("  3. test_looking_for_out_of_bounds, needs LD_PRELOAD=./libmymalloc.so .\n");
+        printf("  4. benchmarks the placement policies with up to 200000 live blocks, and allocating into equal-size holes.\n\n");
         return 1;
     }
 
@@ -936,6 +2019,24 @@ int main(int argc, char *argv[])
         test_memory_fragmentation_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 2048});
         test_random_blocks_multithread((TestParams){.num_threads = base_num_threads, .block_size = 1024});
 
+        test_size_class_reuse();
+        test_cross_thread_free();
+        test_slab_multithread((TestParams){.num_threads = base_num_threads, .iterations = 1000});
+        test_placement_policies();
+        test_aligned_alloc();
+        test_mmap_pool();
+        test_resize_in_place();
+        test_arena_multithread((TestParams){.num_threads = base_num_threads});
+        test_mem_stats();
+        test_latency_histograms((TestParams){.num_threads = base_num_threads});
+        test_error_reporting();
+        test_shared_search_multithread((TestParams){.num_threads = base_num_threads, .iterations = 200});
+        test_sharded_pool((TestParams){.num_threads = base_num_threads});
+        test_batch_alloc_free();
+        test_region();
+        test_calloc();
+        test_handles_compaction();
+
         break;
 
     case 1:
@@ -985,6 +2086,15 @@ int main(int argc, char *argv[])
         test_looking_for_out_of_bounds();
         break;
 
+    case 4:
+        printf("\n*** Benchmarking placement policies: ***\n");
+        for (int live_blocks = 1000; live_blocks <= 200000; live_blocks *= 10)
+            benchmark_placement_policies(live_blocks);
+        benchmark_placement_policies(200000);
+        for (int live_blocks = 1000; live_blocks <= 100000; live_blocks *= 10)
+            benchmark_equal_size_holes(live_blocks);
+        break;
+
     default:
         printf("Invalid test function\n");
         break;
@@ -0,0 +1,246 @@
+#include "unrolled_list.h"
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <stddef.h>
+#include <math.h>
+#include "common_defs.h"
+#include "gitdata.h"
+
+typedef struct
+{
+    UnrolledList *list; // The list shared by all threads
+    int start_value;    // First value the thread inserts
+    int num_values;     // Number of values to insert
+} thread_data_t;
+
+typedef struct
+{
+    int num_threads;
+    int num_values;
+} TestParams;
+
+// Pool size for 'num_values' values: enough nodes if every one is only half full, plus their alignment
+size_t pool_size(int num_values)
+{
+    return (2 * num_values / UNROLLED_CAPACITY + 2) * (UNROLLED_NODE_SIZE + UNROLLED_NODE_ALIGNMENT);
+}
+
+// Compares the list with 'expected', value by value, and checks every node but the last is at least half full
+int list_matches(UnrolledList *list, uint16_t *expected, size_t count)
+{
+    size_t i = 0;
+    for (UnrolledNode *node = list->head; node != NULL; node = node->next)
+    {
+        if (node->next != NULL && node->count < UNROLLED_CAPACITY / 2)
+            return 0;
+        for (int j = 0; j < node->count; j++)
+            if (i >= count || node->values[j] != expected[i++])
+                return 0;
+    }
+    return i == count && unrolled_count(list) == count;
+}
+
+// ********* Test basic unrolled list operations *********
+
+void test_unrolled_layout()
+{
+    printf_yellow("  Testing unrolled node layout ---> ");
+    UnrolledList list;
+    unrolled_init(&list, pool_size(1000));
+
+    my_assert(sizeof(UnrolledNode) == UNROLLED_NODE_SIZE);
+    for (int i = 0; i < 1000; i++)
+        unrolled_insert(&list, i);
+
+    // Appended values fill every node completely
+    int nodes = 0;
+    for (UnrolledNode *node = list.head; node != NULL; node = node->next)
+    {
+        my_assert(((size_t)node & (UNROLLED_NODE_ALIGNMENT - 1)) == 0);
+        my_assert(node->next == NULL || node->count == UNROLLED_CAPACITY);
+        nodes++;
+    }
+    my_assert(nodes == (1000 + UNROLLED_CAPACITY - 1) / UNROLLED_CAPACITY);
+    my_assert(unrolled_count(&list) == 1000);
+    my_assert(unrolled_search(&list, 0) == 0 && unrolled_search(&list, 999) == 999);
+    my_assert(unrolled_search(&list, 1000) == -1);
+
+    unrolled_cleanup(&list);
+    my_assert(list.head == NULL);
+    printf_green("[PASS].\n");
+}
+
+/*
+    Applies random inserts and deletes to the list and to a plain array side by side.
+    The test passes if the list always holds the same values in the same order as the array.
+*/
+void test_unrolled_random_ops(int count)
+{
+    printf_yellow("  Testing unrolled insert_at and delete (operations: %d) ---> ", count);
+    UnrolledList list;
+    unrolled_init(&list, pool_size(count));
+
+    uint16_t *expected = malloc(count * sizeof(uint16_t));
+    size_t size = 0;
+    int matches = 1;
+    for (int i = 0; i < count; i++)
+    {
+        if (size > 0 && rand() % 3 == 0)
+        {
+            // Delete the first occurrence of a value that is in the list
+            uint16_t value = expected[rand() % size];
+            size_t at = 0;
+            while (expected[at] != value)
+                at++;
+            memmove(expected + at, expected + at + 1, (size - at - 1) * sizeof(uint16_t));
+            size--;
+            unrolled_delete(&list, value);
+        }
+        else
+        {
+            size_t at = rand() % (size + 1);
+            uint16_t value = rand() % 512;
+            memmove(expected + at + 1, expected + at, (size - at) * sizeof(uint16_t));
+            expected[at] = value;
+            size++;
+            unrolled_insert_at(&list, at, value);
+        }
+
+        if (i % 64 == 0)
+            matches = matches && list_matches(&list, expected, size);
+    }
+    my_assert(matches && list_matches(&list, expected, size));
+
+    // Deleting everything frees every node
+    while (size > 0)
+        unrolled_delete(&list, expected[--size]);
+    my_assert(list.head == NULL && list.tail == NULL && unrolled_count(&list) == 0);
+
+    free(expected);
+    unrolled_cleanup(&list);
+    printf_green("[PASS].\n");
+}
+
+void test_unrolled_display()
+{
+    printf_yellow("  Testing unrolled_display ---> ");
+    UnrolledList list;
+    unrolled_init(&list, pool_size(3));
+
+    char buffer[64] = {0};
+    FILE *original_stdout = stdout;
+    FILE *fp = tmpfile();
+    stdout = fp;
+    unrolled_display(&list);
+    unrolled_insert(&list, 1);
+    unrolled_insert(&list, 2);
+    unrolled_insert_at(&list, 0, 3);
+    unrolled_display(&list);
+    fflush(fp);
+    rewind(fp);
+    fread(buffer, 1, sizeof(buffer) - 1, fp);
+    fclose(fp);
+    stdout = original_stdout;
+
+    my_assert(strcmp(buffer, "[][3, 1, 2]") == 0);
+    unrolled_cleanup(&list);
+    printf_green("[PASS].\n");
+}
+
+void *thread_insert_function(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    for (int i = 0; i < data->num_values; i++)
+    {
+        unrolled_insert(data->list, data->start_value + i);
+    }
+    return NULL;
+}
+
+void test_unrolled_insert_multithread(TestParams *params)
+{
+    printf_yellow("  Testing unrolled_insert (threads: %d, values: %d) ---> ", params->num_threads, params->num_values);
+
+    UnrolledList list;
+    unrolled_init(&list, pool_size(params->num_values));
+
+    pthread_t *threads = malloc(params->num_threads * sizeof(pthread_t));
+    thread_data_t *thread_data = malloc(params->num_threads * sizeof(thread_data_t));
+    int values_per_thread = params->num_values / params->num_threads;
+    for (int i = 0; i < params->num_threads; i++)
+    {
+        thread_data[i] = (thread_data_t){.list = &list, .start_value = i * values_per_thread, .num_values = values_per_thread};
+        if (pthread_create(&threads[i], NULL, thread_insert_function, &thread_data[i]))
+        {
+            perror("Failed to create thread");
+        }
+    }
+
+    for (int i = 0; i < params->num_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    // Every value made it in exactly once
+    my_assert(unrolled_count(&list) == (size_t)(values_per_thread * params->num_threads));
+    for (int i = 0; i < values_per_thread * params->num_threads; i++)
+        my_assert(unrolled_search(&list, i) >= 0);
+
+    unrolled_cleanup(&list);
+    free(threads);
+    free(thread_data);
+    printf_green("[PASS].\n");
+}
+
+// Main function to run all tests
+int main(int argc, char *argv[])
+{
+    int base_num_threads = 4;
+
+    srand(time(NULL));
+#ifdef VERSION
+    printf("Build Version; %s \n", VERSION);
+#endif
+    printf("Git Version; %s/%s \n", git_date, git_sha);
+    if (argc < 2)
+    {
+        printf("Usage: %s <test function>\n", argv[0]);
+        printf("Available test functions:\n");
+        printf(" 1. test_unrolled_layout - Test node layout and appending\n");
+        printf(" 2. test_unrolled_random_ops - Test inserts and deletes against an array\n");
+        printf(" 3. test_unrolled_insert_multithread - Test inserts with a base number of threads\n");
+        printf(" 0. Run all tests\n");
+        return 1;
+    }
+
+    switch (atoi(argv[1]))
+    {
+    case -1:
+        printf("No tests will be executed.\n");
+        break;
+    case 0:
+        printf("Testing unrolled list operations:\n");
+        test_unrolled_layout();
+        test_unrolled_random_ops(20000);
+        test_unrolled_display();
+        test_unrolled_insert_multithread(&(TestParams){.num_threads = base_num_threads, .num_values = 16384});
+        break;
+    case 1:
+        test_unrolled_layout();
+        break;
+    case 2:
+        test_unrolled_random_ops(20000);
+        break;
+    case 3:
+        test_unrolled_insert_multithread(&(TestParams){.num_threads = base_num_threads, .num_values = 16384});
+        break;
+
+    default:
+        printf("Invalid test function\n");
+        break;
+    }
+
+    return 0;
+}
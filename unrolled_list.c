@@ -0,0 +1,238 @@
+#include "unrolled_list.h"
+
+// Allocates an empty node at the start of a cache line, or returns NULL if the pool is full
+static UnrolledNode* node_create(){
+    UnrolledNode* node = mem_alloc_aligned(sizeof(UnrolledNode), UNROLLED_NODE_ALIGNMENT);
+    if(node == NULL){
+        // Can't allocate new node
+        printf("ERROR!");
+        return NULL;
+    }
+    node->next = NULL;
+    node->count = 0;
+    return node;
+}
+
+// Moves the back half of a full node's values into a new node behind it.
+// Returns the new node, or NULL if there is no room for it
+static UnrolledNode* node_split(UnrolledList* list, UnrolledNode* node){
+    UnrolledNode* new_node = node_create();
+    if(new_node == NULL)
+        return NULL;
+
+    uint16_t keep = node->count / 2;
+    new_node->count = node->count - keep;
+    memcpy(new_node->values, node->values + keep, new_node->count * sizeof(uint16_t));
+    node->count = keep;
+
+    new_node->next = node->next;
+    node->next = new_node;
+    if(list->tail == node)
+        list->tail = new_node;
+    return new_node;
+}
+
+// Refills a node that dropped below half full from the node behind it,
+// merging the two if the values of both fit in one
+static void node_rebalance(UnrolledList* list, UnrolledNode* node){
+    UnrolledNode* next_node = node->next;
+    if(node->count >= UNROLLED_CAPACITY / 2 || next_node == NULL)
+        return;
+
+    if(node->count + next_node->count <= UNROLLED_CAPACITY){
+        memcpy(node->values + node->count, next_node->values, next_node->count * sizeof(uint16_t));
+        node->count += next_node->count;
+        node->next = next_node->next;
+        if(list->tail == next_node)
+            list->tail = node;
+
+        mem_free(next_node);
+    }
+    else{
+        // Even the two out, which leaves both at least half full
+        uint16_t moved = (next_node->count - node->count) / 2;
+        memcpy(node->values + node->count, next_node->values, moved * sizeof(uint16_t));
+        memmove(next_node->values, next_node->values + moved, (next_node->count - moved) * sizeof(uint16_t));
+        node->count += moved;
+        next_node->count -= moved;
+    }
+}
+
+// Inserts new value 'data' at the end of the list, in the tail node while it has room
+static void append(UnrolledList* list, uint16_t data){
+    UnrolledNode* node = list->tail;
+    if(node == NULL || node->count == UNROLLED_CAPACITY){
+        UnrolledNode* new_node = node_create();
+        if(new_node == NULL)
+            return;
+
+        if(node == NULL)
+            list->head = new_node;
+        else
+            node->next = new_node;
+        list->tail = new_node;
+        node = new_node;
+    }
+
+    node->values[node->count++] = data;
+    list->count++;
+}
+
+// Initializes the list by intiliazing the memory_manager with a memory pool of 'size'
+void unrolled_init(UnrolledList* list, size_t size){
+    pthread_rwlock_init(&list->lock, NULL);
+
+    mem_init(size);
+    list->head = NULL;
+    list->tail = NULL;
+    list->count = 0;
+}
+
+// Inserts new value 'data' at the end of the list
+void unrolled_insert(UnrolledList* list, uint16_t data){
+    pthread_rwlock_wrlock(&list->lock);
+    append(list, data);
+    pthread_rwlock_unlock(&list->lock);
+}
+
+// Inserts new value 'data' so it ends up at position 'index' of the list,
+// or at the end if the list is shorter than that
+void unrolled_insert_at(UnrolledList* list, size_t index, uint16_t data){
+    pthread_rwlock_wrlock(&list->lock);
+
+    if(index >= list->count){
+        append(list, data);
+        pthread_rwlock_unlock(&list->lock);
+        return;
+    }
+
+    // Skip whole nodes until the one holding position 'index'
+    UnrolledNode* node = list->head;
+    while(index >= node->count){
+        index -= node->count;
+        node = node->next;
+    }
+
+    // A full node is split in two first, and the value goes into whichever half holds its position
+    if(node->count == UNROLLED_CAPACITY){
+        if(node_split(list, node) == NULL){
+            pthread_rwlock_unlock(&list->lock);
+            return;
+        }
+        if(index > node->count){
+            index -= node->count;
+            node = node->next;
+        }
+    }
+
+    memmove(node->values + index + 1, node->values + index, (node->count - index) * sizeof(uint16_t));
+    node->values[index] = data;
+    node->count++;
+    list->count++;
+
+    pthread_rwlock_unlock(&list->lock);
+}
+
+// Delete the first value that equals 'data'
+void unrolled_delete(UnrolledList* list, uint16_t data){
+    pthread_rwlock_wrlock(&list->lock);
+
+    UnrolledNode* prev = NULL;
+    for(UnrolledNode* node = list->head; node != NULL; prev = node, node = node->next){
+        for(uint16_t i = 0; i < node->count; i++){
+            if(node->values[i] != data)
+                continue;
+
+            memmove(node->values + i, node->values + i + 1, (node->count - i - 1) * sizeof(uint16_t));
+            node->count--;
+            list->count--;
+
+            // An emptied node is unlinked, any other one is kept at least half full
+            if(node->count == 0){
+                if(prev == NULL)
+                    list->head = node->next;
+                else
+                    prev->next = node->next;
+                if(list->tail == node)
+                    list->tail = prev;
+
+                mem_free(node);
+            }
+            else{
+                node_rebalance(list, node);
+            }
+
+            pthread_rwlock_unlock(&list->lock);
+            return;
+        }
+    }
+
+    pthread_rwlock_unlock(&list->lock);
+}
+
+// Searches the list for 'data', returns its position or -1 if it isn't in the list.
+// Each node's values are scanned as one array
+long unrolled_search(UnrolledList* list, uint16_t data){
+    pthread_rwlock_rdlock(&list->lock);
+
+    long offset = 0;
+    for(UnrolledNode* node = list->head; node != NULL; node = node->next){
+        for(uint16_t i = 0; i < node->count; i++){
+            if(node->values[i] == data){
+                pthread_rwlock_unlock(&list->lock);
+                return offset + i;
+            }
+        }
+        offset += node->count;
+    }
+
+    pthread_rwlock_unlock(&list->lock);
+    return -1;
+}
+
+// Displays the entire list in format [0, 1, 2, 3, etc]
+void unrolled_display(UnrolledList* list){
+    pthread_rwlock_rdlock(&list->lock);
+
+    printf("[");
+    const char* separator = "";
+    for(UnrolledNode* node = list->head; node != NULL; node = node->next){
+        for(uint16_t i = 0; i < node->count; i++){
+            printf("%s%d", separator, node->values[i]);
+            separator = ", ";
+        }
+    }
+    printf("]");
+
+    pthread_rwlock_unlock(&list->lock);
+}
+
+// Number of values in the list, kept up to date so it doesn't have to be counted
+size_t unrolled_count(UnrolledList* list){
+    pthread_rwlock_rdlock(&list->lock);
+    size_t count = list->count;
+    pthread_rwlock_unlock(&list->lock);
+    return count;
+}
+
+// Deinitializes the list, by freeing all related memory
+void unrolled_cleanup(UnrolledList* list){
+    pthread_rwlock_wrlock(&list->lock);
+
+    UnrolledNode* walker = list->head;
+    while(walker != NULL){
+        UnrolledNode* toDel = walker;
+        walker = walker->next;
+
+        mem_free(toDel);
+    }
+
+    // Deinitializes the memory
+    mem_deinit();
+    list->head = NULL;
+    list->tail = NULL;
+    list->count = 0;
+
+    pthread_rwlock_unlock(&list->lock);
+    pthread_rwlock_destroy(&list->lock);
+}
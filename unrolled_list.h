@@ -0,0 +1,44 @@
+// unrolled_list.h
+#ifndef UNROLLED_LIST_H
+#define UNROLLED_LIST_H
+
+#include "memory_manager.h" // Include your custom memory manager
+#include <stdint.h>
+#include <pthread.h>
+
+// Every node fills two cache lines, and starts at the beginning of one
+#define UNROLLED_NODE_SIZE 128
+#define UNROLLED_NODE_ALIGNMENT 64
+// Values per node: what is left of the node after its link and count
+#define UNROLLED_CAPACITY ((UNROLLED_NODE_SIZE - sizeof(void *) - sizeof(uint16_t)) / sizeof(uint16_t))
+
+typedef struct UnrolledNode
+{
+    struct UnrolledNode *next;          // Pointer to the next node in the list
+    uint16_t count;                     // Number of values in use, they fill the front of 'values'
+    uint16_t values[UNROLLED_CAPACITY]; // The values, packed in list order
+} UnrolledNode;
+
+// A list of uint16_t values stored many to a node, so walking it streams through memory
+// instead of taking a cache miss per value. Nodes are kept at least half full
+typedef struct UnrolledList
+{
+    UnrolledNode *head;
+    UnrolledNode *tail;
+    size_t count; // Number of values in the list
+    pthread_rwlock_t lock;
+} UnrolledList;
+
+// Function declarations
+void unrolled_init(UnrolledList *list, size_t size);
+void unrolled_insert(UnrolledList *list, uint16_t data);
+void unrolled_insert_at(UnrolledList *list, size_t index, uint16_t data);
+void unrolled_delete(UnrolledList *list, uint16_t data);
+long unrolled_search(UnrolledList *list, uint16_t data);
+
+void unrolled_display(UnrolledList *list);
+
+size_t unrolled_count(UnrolledList *list);
+void unrolled_cleanup(UnrolledList *list);
+
+#endif // UNROLLED_LIST_H